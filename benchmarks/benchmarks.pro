@@ -0,0 +1,6 @@
+# Benchmarks of the plugin internals, not part of the plugin build:
+#   qmake benchmarks/benchmarks.pro && make && make check
+TEMPLATE = subdirs
+
+SUBDIRS += watch \
+    load \
@@ -0,0 +1,898 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* Copyright 2013 - 2020, nymea GmbH
+* Contact: contact@nymea.io
+*
+* This file is part of nymea.
+* This project including source code and documentation is protected by
+* copyright law, and remains the property of nymea GmbH. All rights, including
+* reproduction, publication, editing and translation, are reserved. The use of
+* this project is subject to the terms of a license agreement to be concluded
+* with nymea GmbH in accordance with the terms of use of nymea GmbH, available
+* under https://nymea.io/license
+*
+* GNU Lesser General Public License Usage
+* Alternatively, this project may be redistributed and/or modified under the
+* terms of the GNU Lesser General Public License as published by the Free
+* Software Foundation; version 3. This project is distributed in the hope that
+* it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+* warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this project. If not, see <https://www.gnu.org/licenses/>.
+*
+* For any further details and any questions please contact us under
+* contact@nymea.io or see our FAQ/Licensing Information on
+* https://nymea.io/license/faq
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include "fakeavahi.h"
+
+#include <QHash>
+#include <QMultiHash>
+#include <QSet>
+#include <QList>
+#include <QRandomGenerator>
+
+#include <avahi-client/lookup.h>
+#include <avahi-client/publish.h>
+#include <avahi-common/error.h>
+#include <avahi-common/strlst.h>
+#include <avahi-common/timeval.h>
+
+#include <functional>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Base of the objects handed out by the fake client. Queued events only carry the id,
+// events of objects freed before they were dispatched are dropped like in libavahi-client.
+struct FakeAvahiObject
+{
+    virtual ~FakeAvahiObject() = default;
+
+    quint64 id = 0;
+    AvahiClient *client = nullptr;
+};
+
+// Returns false if the receiver was gone
+typedef std::function<bool()> FakeAvahiEvent;
+
+struct FakeAvahiDelayedEvent
+{
+    AvahiClient *client = nullptr;
+    AvahiTimeout *timeout = nullptr;
+    FakeAvahiEvent event;
+};
+
+struct AvahiClient
+{
+    const AvahiPoll *poll = nullptr;
+    AvahiClientCallback callback = nullptr;
+    void *userdata = nullptr;
+    AvahiClientState state = AVAHI_CLIENT_S_RUNNING;
+    int error = AVAHI_OK;
+
+    // Events are written to fds[1] and dispatched when fds[0] becomes readable
+    int fds[2] = { -1, -1 };
+    AvahiWatch *watch = nullptr;
+    QList<FakeAvahiEvent> events;
+    QSet<FakeAvahiDelayedEvent*> delayedEvents;
+    bool woken = false;
+    // Requests are pending, the watch waits for the socket to become writable
+    bool sending = false;
+
+    QSet<FakeAvahiObject*> objects;
+};
+
+struct AvahiServiceTypeBrowser : FakeAvahiObject
+{
+    AvahiServiceTypeBrowserCallback callback = nullptr;
+    void *userdata = nullptr;
+};
+
+struct AvahiServiceBrowser : FakeAvahiObject
+{
+    QString serviceType;
+    AvahiIfIndex interface = AVAHI_IF_UNSPEC;
+    AvahiProtocol protocol = AVAHI_PROTO_UNSPEC;
+    AvahiServiceBrowserCallback callback = nullptr;
+    void *userdata = nullptr;
+};
+
+struct AvahiServiceResolver : FakeAvahiObject
+{
+    QString serviceType;
+    QString name;
+    AvahiLookupFlags flags = (AvahiLookupFlags) 0;
+    AvahiServiceResolverCallback callback = nullptr;
+    void *userdata = nullptr;
+};
+
+struct AvahiHostNameResolver : FakeAvahiObject
+{
+    QString hostName;
+    AvahiHostNameResolverCallback callback = nullptr;
+    void *userdata = nullptr;
+};
+
+struct AvahiEntryGroup : FakeAvahiObject
+{
+    AvahiEntryGroupCallback callback = nullptr;
+    void *userdata = nullptr;
+    AvahiEntryGroupState state = AVAHI_ENTRY_GROUP_UNCOMMITED;
+    QList<FakeAvahiNetwork::Service> services;
+    // Bumped on every commit and reset, a pending ESTABLISHED of an older commit is dropped
+    quint64 commit = 0;
+};
+
+class FakeAvahiNetworkPrivate
+{
+public:
+    static FakeAvahiNetworkPrivate *get() { return FakeAvahiNetwork::instance()->d; }
+    static QString serviceKey(const QString &serviceType, const QString &name) { return serviceType + '\n' + name; }
+    static AvahiProtocol protocol(const FakeAvahiNetwork::Service &service);
+
+    void registerObject(AvahiClient *client, FakeAvahiObject *object);
+    void freeObject(FakeAvahiObject *object);
+    template <typename T> T *object(quint64 id) const { return static_cast<T*>(m_objects.value(id)); }
+
+    // Delivered through the socket pair of the client, after the delay through a poll timeout first
+    void post(AvahiClient *client, const FakeAvahiEvent &event, int delay = 0);
+    // The client has data to send until the watch reports the socket writable
+    void request(AvahiClient *client);
+    void wake(AvahiClient *client);
+
+    void publish(const FakeAvahiNetwork::Service &service, quint64 owner);
+    void withdraw(const QString &key);
+    void withdrawGroup(AvahiEntryGroup *group);
+
+    void postServiceType(AvahiServiceTypeBrowser *browser, AvahiBrowserEvent event, const QString &serviceType = QString());
+    void postService(AvahiServiceBrowser *browser, AvahiBrowserEvent event, const FakeAvahiNetwork::Service &service);
+    void postBrowserEvent(AvahiServiceBrowser *browser, AvahiBrowserEvent event);
+    void postResolve(AvahiServiceResolver *resolver, int delay);
+    void postHostNameResolve(AvahiHostNameResolver *resolver);
+    void postGroupState(AvahiEntryGroup *group, AvahiEntryGroupState state);
+    void postEstablish(AvahiEntryGroup *group);
+
+    bool resolveFails() const;
+
+    static void watchCallback(AvahiWatch *watch, int fd, AvahiWatchEvent event, void *userdata);
+    static void timeoutCallback(AvahiTimeout *timeout, void *userdata);
+
+    // Events dispatched per wakeup, like the D-Bus dispatcher returning to the main loop in between
+    static const int s_dispatchBatch = 64;
+
+    AvahiIfIndex m_interface = 1;
+
+    QHash<QString, FakeAvahiNetwork::Service> m_services;
+    // Entry group publishing the service, 0 for injected ones
+    QHash<QString, quint64> m_owners;
+    QHash<QString, int> m_serviceTypes;
+    // Host names stay resolvable after their services are gone
+    QHash<QString, QHostAddress> m_hosts;
+
+    QSet<AvahiClient*> m_clients;
+    QHash<quint64, FakeAvahiObject*> m_objects;
+    quint64 m_nextId = 1;
+    QList<AvahiServiceTypeBrowser*> m_serviceTypeBrowsers;
+    QMultiHash<QString, AvahiServiceBrowser*> m_serviceBrowsers;
+    QMultiHash<QString, AvahiServiceResolver*> m_serviceResolvers;
+
+    double m_resolveFailureRatio = 0;
+    int m_resolveDelay = 0;
+    int m_establishDelay = 0;
+
+    quint64 m_deliveredEvents = 0;
+    quint64 m_requests = 0;
+};
+
+AvahiProtocol FakeAvahiNetworkPrivate::protocol(const FakeAvahiNetwork::Service &service)
+{
+    return service.hostAddress.protocol() == QAbstractSocket::IPv6Protocol ? AVAHI_PROTO_INET6 : AVAHI_PROTO_INET;
+}
+
+void FakeAvahiNetworkPrivate::registerObject(AvahiClient *client, FakeAvahiObject *object)
+{
+    object->id = m_nextId++;
+    object->client = client;
+    client->objects.insert(object);
+    m_objects.insert(object->id, object);
+}
+
+void FakeAvahiNetworkPrivate::freeObject(FakeAvahiObject *object)
+{
+    if (AvahiServiceTypeBrowser *browser = dynamic_cast<AvahiServiceTypeBrowser*>(object)) {
+        m_serviceTypeBrowsers.removeOne(browser);
+    } else if (AvahiServiceBrowser *browser = dynamic_cast<AvahiServiceBrowser*>(object)) {
+        m_serviceBrowsers.remove(browser->serviceType, browser);
+    } else if (AvahiServiceResolver *resolver = dynamic_cast<AvahiServiceResolver*>(object)) {
+        m_serviceResolvers.remove(serviceKey(resolver->serviceType, resolver->name), resolver);
+    } else if (AvahiEntryGroup *group = dynamic_cast<AvahiEntryGroup*>(object)) {
+        withdrawGroup(group);
+    }
+
+    object->client->objects.remove(object);
+    m_objects.remove(object->id);
+    delete object;
+}
+
+void FakeAvahiNetworkPrivate::post(AvahiClient *client, const FakeAvahiEvent &event, int delay)
+{
+    if (delay > 0) {
+        struct timeval tv;
+        FakeAvahiDelayedEvent *delayedEvent = new FakeAvahiDelayedEvent;
+        delayedEvent->client = client;
+        delayedEvent->event = event;
+        delayedEvent->timeout = client->poll->timeout_new(client->poll, avahi_elapse_time(&tv, delay, 0), timeoutCallback, delayedEvent);
+        client->delayedEvents.insert(delayedEvent);
+        return;
+    }
+
+    client->events.append(event);
+    wake(client);
+}
+
+void FakeAvahiNetworkPrivate::request(AvahiClient *client)
+{
+    m_requests++;
+    if (client->sending) {
+        return;
+    }
+    client->sending = true;
+    client->poll->watch_update(client->watch, (AvahiWatchEvent) (AVAHI_WATCH_IN | AVAHI_WATCH_OUT));
+}
+
+void FakeAvahiNetworkPrivate::wake(AvahiClient *client)
+{
+    if (client->woken) {
+        return;
+    }
+    char byte = 0;
+    client->woken = ::write(client->fds[1], &byte, 1) == 1;
+}
+
+void FakeAvahiNetworkPrivate::publish(const FakeAvahiNetwork::Service &service, quint64 owner)
+{
+    QString key = serviceKey(service.serviceType, service.name);
+    if (m_services.contains(key)) {
+        withdraw(key);
+    }
+
+    m_services.insert(key, service);
+    m_owners.insert(key, owner);
+    m_hosts.insert(service.hostName, service.hostAddress);
+
+    if (m_serviceTypes[service.serviceType]++ == 0) {
+        foreach (AvahiServiceTypeBrowser *browser, m_serviceTypeBrowsers) {
+            postServiceType(browser, AVAHI_BROWSER_NEW, service.serviceType);
+        }
+    }
+    foreach (AvahiServiceBrowser *browser, m_serviceBrowsers.values(service.serviceType)) {
+        postService(browser, AVAHI_BROWSER_NEW, service);
+    }
+}
+
+void FakeAvahiNetworkPrivate::withdraw(const QString &key)
+{
+    FakeAvahiNetwork::Service service = m_services.take(key);
+    m_owners.remove(key);
+
+    foreach (AvahiServiceBrowser *browser, m_serviceBrowsers.values(service.serviceType)) {
+        postService(browser, AVAHI_BROWSER_REMOVE, service);
+    }
+    if (--m_serviceTypes[service.serviceType] == 0) {
+        m_serviceTypes.remove(service.serviceType);
+        foreach (AvahiServiceTypeBrowser *browser, m_serviceTypeBrowsers) {
+            postServiceType(browser, AVAHI_BROWSER_REMOVE, service.serviceType);
+        }
+    }
+}
+
+void FakeAvahiNetworkPrivate::withdrawGroup(AvahiEntryGroup *group)
+{
+    if (group->state != AVAHI_ENTRY_GROUP_ESTABLISHED) {
+        return;
+    }
+    foreach (const FakeAvahiNetwork::Service &service, group->services) {
+        QString key = serviceKey(service.serviceType, service.name);
+        if (m_owners.value(key) == group->id) {
+            withdraw(key);
+        }
+    }
+}
+
+void FakeAvahiNetworkPrivate::postServiceType(AvahiServiceTypeBrowser *browser, AvahiBrowserEvent event, const QString &serviceType)
+{
+    quint64 id = browser->id;
+    post(browser->client, [this, id, event, serviceType]() {
+        AvahiServiceTypeBrowser *browser = object<AvahiServiceTypeBrowser>(id);
+        if (!browser) {
+            return false;
+        }
+        QByteArray type = serviceType.toUtf8();
+        browser->callback(browser,
+                          m_interface,
+                          AVAHI_PROTO_INET,
+                          event,
+                          serviceType.isEmpty() ? nullptr : type.constData(),
+                          serviceType.isEmpty() ? nullptr : "local",
+                          AVAHI_LOOKUP_RESULT_MULTICAST,
+                          browser->userdata);
+        return true;
+    });
+}
+
+void FakeAvahiNetworkPrivate::postService(AvahiServiceBrowser *browser, AvahiBrowserEvent event, const FakeAvahiNetwork::Service &service)
+{
+    AvahiProtocol serviceProtocol = protocol(service);
+    if ((browser->interface != AVAHI_IF_UNSPEC && browser->interface != m_interface)
+            || (browser->protocol != AVAHI_PROTO_UNSPEC && browser->protocol != serviceProtocol)) {
+        return;
+    }
+
+    quint64 id = browser->id;
+    QByteArray name = service.name.toUtf8();
+    QByteArray type = service.serviceType.toUtf8();
+    post(browser->client, [this, id, event, serviceProtocol, name, type]() {
+        AvahiServiceBrowser *browser = object<AvahiServiceBrowser>(id);
+        if (!browser) {
+            return false;
+        }
+        browser->callback(browser,
+                          m_interface,
+                          serviceProtocol,
+                          event,
+                          name.constData(),
+                          type.constData(),
+                          "local",
+                          AVAHI_LOOKUP_RESULT_MULTICAST,
+                          browser->userdata);
+        return true;
+    });
+}
+
+void FakeAvahiNetworkPrivate::postBrowserEvent(AvahiServiceBrowser *browser, AvahiBrowserEvent event)
+{
+    quint64 id = browser->id;
+    post(browser->client, [this, id, event]() {
+        AvahiServiceBrowser *browser = object<AvahiServiceBrowser>(id);
+        if (!browser) {
+            return false;
+        }
+        browser->callback(browser, m_interface, AVAHI_PROTO_UNSPEC, event, nullptr, nullptr, nullptr, (AvahiLookupResultFlags) 0, browser->userdata);
+        return true;
+    });
+}
+
+void FakeAvahiNetworkPrivate::postResolve(AvahiServiceResolver *resolver, int delay)
+{
+    quint64 id = resolver->id;
+    post(resolver->client, [this, id]() {
+        AvahiServiceResolver *resolver = object<AvahiServiceResolver>(id);
+        if (!resolver) {
+            return false;
+        }
+
+        QByteArray name = resolver->name.toUtf8();
+        QByteArray type = resolver->serviceType.toUtf8();
+        QHash<QString, FakeAvahiNetwork::Service>::const_iterator it = m_services.constFind(serviceKey(resolver->serviceType, resolver->name));
+        if (it == m_services.constEnd() || resolveFails()) {
+            resolver->client->error = AVAHI_ERR_TIMEOUT;
+            resolver->callback(resolver, m_interface, AVAHI_PROTO_INET, AVAHI_RESOLVER_FAILURE, name.constData(), type.constData(), "local",
+                               nullptr, nullptr, 0, nullptr, (AvahiLookupResultFlags) 0, resolver->userdata);
+            return true;
+        }
+
+        const FakeAvahiNetwork::Service &service = it.value();
+        AvahiAddress address;
+        bool hasAddress = !(resolver->flags & AVAHI_LOOKUP_NO_ADDRESS)
+                && avahi_address_parse(service.hostAddress.toString().toUtf8().constData(), AVAHI_PROTO_UNSPEC, &address);
+        AvahiStringList *txt = nullptr;
+        if (!(resolver->flags & AVAHI_LOOKUP_NO_TXT)) {
+            // avahi_string_list_add() prepends
+            for (int i = service.txt.count() - 1; i >= 0; i--) {
+                txt = avahi_string_list_add(txt, service.txt.at(i).toUtf8().constData());
+            }
+        }
+        QByteArray hostName = service.hostName.toUtf8();
+        resolver->callback(resolver, m_interface, protocol(service), AVAHI_RESOLVER_FOUND, name.constData(), type.constData(), "local",
+                           hostName.constData(), hasAddress ? &address : nullptr, service.port, txt, AVAHI_LOOKUP_RESULT_MULTICAST, resolver->userdata);
+        avahi_string_list_free(txt);
+        return true;
+    }, delay);
+}
+
+void FakeAvahiNetworkPrivate::postHostNameResolve(AvahiHostNameResolver *resolver)
+{
+    quint64 id = resolver->id;
+    post(resolver->client, [this, id]() {
+        AvahiHostNameResolver *resolver = object<AvahiHostNameResolver>(id);
+        if (!resolver) {
+            return false;
+        }
+
+        QByteArray hostName = resolver->hostName.toUtf8();
+        AvahiAddress address;
+        QHash<QString, QHostAddress>::const_iterator it = m_hosts.constFind(resolver->hostName);
+        if (it == m_hosts.constEnd() || resolveFails() || !avahi_address_parse(it.value().toString().toUtf8().constData(), AVAHI_PROTO_UNSPEC, &address)) {
+            resolver->client->error = AVAHI_ERR_TIMEOUT;
+            resolver->callback(resolver, m_interface, AVAHI_PROTO_INET, AVAHI_RESOLVER_FAILURE, hostName.constData(), nullptr, (AvahiLookupResultFlags) 0, resolver->userdata);
+            return true;
+        }
+        resolver->callback(resolver, m_interface, address.proto, AVAHI_RESOLVER_FOUND, hostName.constData(), &address, AVAHI_LOOKUP_RESULT_MULTICAST, resolver->userdata);
+        return true;
+    }, m_resolveDelay);
+}
+
+void FakeAvahiNetworkPrivate::postGroupState(AvahiEntryGroup *group, AvahiEntryGroupState state)
+{
+    quint64 id = group->id;
+    post(group->client, [this, id, state]() {
+        AvahiEntryGroup *group = object<AvahiEntryGroup>(id);
+        if (!group) {
+            return false;
+        }
+        group->callback(group, state, group->userdata);
+        return true;
+    });
+}
+
+void FakeAvahiNetworkPrivate::postEstablish(AvahiEntryGroup *group)
+{
+    quint64 id = group->id;
+    quint64 commit = group->commit;
+    post(group->client, [this, id, commit]() {
+        AvahiEntryGroup *group = object<AvahiEntryGroup>(id);
+        if (!group) {
+            return false;
+        }
+        if (group->commit != commit) {
+            return true;
+        }
+
+        foreach (const FakeAvahiNetwork::Service &service, group->services) {
+            QString key = serviceKey(service.serviceType, service.name);
+            if (m_services.contains(key) && m_owners.value(key) != group->id) {
+                group->state = AVAHI_ENTRY_GROUP_COLLISION;
+                group->callback(group, group->state, group->userdata);
+                return true;
+            }
+        }
+
+        group->state = AVAHI_ENTRY_GROUP_ESTABLISHED;
+        foreach (const FakeAvahiNetwork::Service &service, group->services) {
+            publish(service, group->id);
+        }
+        group->callback(group, group->state, group->userdata);
+        return true;
+    }, m_establishDelay);
+}
+
+bool FakeAvahiNetworkPrivate::resolveFails() const
+{
+    return m_resolveFailureRatio > 0 && QRandomGenerator::global()->generateDouble() < m_resolveFailureRatio;
+}
+
+void FakeAvahiNetworkPrivate::watchCallback(AvahiWatch *watch, int fd, AvahiWatchEvent event, void *userdata)
+{
+    AvahiClient *client = static_cast<AvahiClient*>(userdata);
+    FakeAvahiNetworkPrivate *d = get();
+
+    if (event & AVAHI_WATCH_OUT) {
+        // Everything is sent, stop watching for writability like the D-Bus transport does
+        client->sending = false;
+        client->poll->watch_update(watch, AVAHI_WATCH_IN);
+    }
+    if (!(event & AVAHI_WATCH_IN)) {
+        return;
+    }
+
+    char buffer[64];
+    while (::read(fd, buffer, sizeof(buffer)) > 0) { }
+    client->woken = false;
+
+    for (int i = 0; i < s_dispatchBatch && !client->events.isEmpty(); i++) {
+        FakeAvahiEvent dispatch = client->events.takeFirst();
+        if (dispatch()) {
+            d->m_deliveredEvents++;
+        }
+        // The callback might have freed the client
+        if (!d->m_clients.contains(client)) {
+            return;
+        }
+    }
+
+    if (!client->events.isEmpty()) {
+        d->wake(client);
+    }
+}
+
+void FakeAvahiNetworkPrivate::timeoutCallback(AvahiTimeout *timeout, void *userdata)
+{
+    FakeAvahiDelayedEvent *delayedEvent = static_cast<FakeAvahiDelayedEvent*>(userdata);
+    AvahiClient *client = delayedEvent->client;
+    client->delayedEvents.remove(delayedEvent);
+    client->poll->timeout_free(timeout);
+    get()->post(client, delayedEvent->event);
+    delete delayedEvent;
+}
+
+FakeAvahiNetwork::FakeAvahiNetwork() :
+    d(new FakeAvahiNetworkPrivate)
+{
+    AvahiIfIndex interface = if_nametoindex("lo");
+    if (interface > 0) {
+        d->m_interface = interface;
+    }
+}
+
+FakeAvahiNetwork::~FakeAvahiNetwork()
+{
+    delete d;
+}
+
+FakeAvahiNetwork *FakeAvahiNetwork::instance()
+{
+    static FakeAvahiNetwork network;
+    return &network;
+}
+
+void FakeAvahiNetwork::addService(const Service &service)
+{
+    d->publish(service, 0);
+}
+
+bool FakeAvahiNetwork::removeService(const QString &serviceType, const QString &name)
+{
+    QString key = FakeAvahiNetworkPrivate::serviceKey(serviceType, name);
+    if (!d->m_services.contains(key)) {
+        return false;
+    }
+    d->withdraw(key);
+    return true;
+}
+
+bool FakeAvahiNetwork::updateServiceTxt(const QString &serviceType, const QString &name, const QStringList &txt)
+{
+    QString key = FakeAvahiNetworkPrivate::serviceKey(serviceType, name);
+    if (!d->m_services.contains(key)) {
+        return false;
+    }
+    d->m_services[key].txt = txt;
+    foreach (AvahiServiceResolver *resolver, d->m_serviceResolvers.values(key)) {
+        d->postResolve(resolver, 0);
+    }
+    return true;
+}
+
+bool FakeAvahiNetwork::containsService(const QString &serviceType, const QString &name) const
+{
+    return d->m_services.contains(FakeAvahiNetworkPrivate::serviceKey(serviceType, name));
+}
+
+int FakeAvahiNetwork::serviceCount() const
+{
+    return d->m_services.count();
+}
+
+double FakeAvahiNetwork::resolveFailureRatio() const
+{
+    return d->m_resolveFailureRatio;
+}
+
+void FakeAvahiNetwork::setResolveFailureRatio(double resolveFailureRatio)
+{
+    d->m_resolveFailureRatio = resolveFailureRatio;
+}
+
+int FakeAvahiNetwork::resolveDelay() const
+{
+    return d->m_resolveDelay;
+}
+
+void FakeAvahiNetwork::setResolveDelay(int resolveDelay)
+{
+    d->m_resolveDelay = resolveDelay;
+}
+
+int FakeAvahiNetwork::establishDelay() const
+{
+    return d->m_establishDelay;
+}
+
+void FakeAvahiNetwork::setEstablishDelay(int establishDelay)
+{
+    d->m_establishDelay = establishDelay;
+}
+
+quint64 FakeAvahiNetwork::deliveredEvents() const
+{
+    return d->m_deliveredEvents;
+}
+
+quint64 FakeAvahiNetwork::requests() const
+{
+    return d->m_requests;
+}
+
+// The libavahi-client API used by the plugin, replacing the library in this benchmark
+
+AvahiClient *avahi_client_new(const AvahiPoll *poll_api, AvahiClientFlags flags, AvahiClientCallback callback, void *userdata, int *error)
+{
+    Q_UNUSED(flags)
+
+    AvahiClient *client = new AvahiClient;
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, client->fds) < 0) {
+        delete client;
+        if (error) {
+            *error = AVAHI_ERR_FAILURE;
+        }
+        return nullptr;
+    }
+
+    client->poll = poll_api;
+    client->callback = callback;
+    client->userdata = userdata;
+    client->watch = poll_api->watch_new(poll_api, client->fds[0], AVAHI_WATCH_IN, FakeAvahiNetworkPrivate::watchCallback, client);
+    FakeAvahiNetworkPrivate::get()->m_clients.insert(client);
+
+    // Like libavahi-client, report the state from within avahi_client_new()
+    if (client->callback) {
+        client->callback(client, client->state, client->userdata);
+    }
+    return client;
+}
+
+void avahi_client_free(AvahiClient *client)
+{
+    if (!client) {
+        return;
+    }
+
+    FakeAvahiNetworkPrivate *d = FakeAvahiNetworkPrivate::get();
+    foreach (FakeAvahiObject *object, client->objects) {
+        d->freeObject(object);
+    }
+    foreach (FakeAvahiDelayedEvent *delayedEvent, client->delayedEvents) {
+        client->poll->timeout_free(delayedEvent->timeout);
+        delete delayedEvent;
+    }
+    client->poll->watch_free(client->watch);
+    ::close(client->fds[0]);
+    ::close(client->fds[1]);
+    d->m_clients.remove(client);
+    delete client;
+}
+
+AvahiClientState avahi_client_get_state(AvahiClient *client)
+{
+    return client->state;
+}
+
+int avahi_client_errno(AvahiClient *client)
+{
+    return client->error;
+}
+
+AvahiServiceTypeBrowser *avahi_service_type_browser_new(AvahiClient *client, AvahiIfIndex interface, AvahiProtocol protocol, const char *domain, AvahiLookupFlags flags, AvahiServiceTypeBrowserCallback callback, void *userdata)
+{
+    Q_UNUSED(interface)
+    Q_UNUSED(protocol)
+    Q_UNUSED(domain)
+    Q_UNUSED(flags)
+
+    FakeAvahiNetworkPrivate *d = FakeAvahiNetworkPrivate::get();
+    AvahiServiceTypeBrowser *browser = new AvahiServiceTypeBrowser;
+    browser->callback = callback;
+    browser->userdata = userdata;
+    d->registerObject(client, browser);
+    d->m_serviceTypeBrowsers.append(browser);
+    d->request(client);
+
+    foreach (const QString &serviceType, d->m_serviceTypes.keys()) {
+        d->postServiceType(browser, AVAHI_BROWSER_NEW, serviceType);
+    }
+    d->postServiceType(browser, AVAHI_BROWSER_CACHE_EXHAUSTED);
+    d->postServiceType(browser, AVAHI_BROWSER_ALL_FOR_NOW);
+    return browser;
+}
+
+int avahi_service_type_browser_free(AvahiServiceTypeBrowser *browser)
+{
+    FakeAvahiNetworkPrivate::get()->freeObject(browser);
+    return AVAHI_OK;
+}
+
+AvahiServiceBrowser *avahi_service_browser_new(AvahiClient *client, AvahiIfIndex interface, AvahiProtocol protocol, const char *type, const char *domain, AvahiLookupFlags flags, AvahiServiceBrowserCallback callback, void *userdata)
+{
+    Q_UNUSED(domain)
+    Q_UNUSED(flags)
+
+    FakeAvahiNetworkPrivate *d = FakeAvahiNetworkPrivate::get();
+    AvahiServiceBrowser *browser = new AvahiServiceBrowser;
+    // Subtype browse types ("_sub._sub._type") match no injected service
+    browser->serviceType = QString::fromUtf8(type);
+    browser->interface = interface;
+    browser->protocol = protocol;
+    browser->callback = callback;
+    browser->userdata = userdata;
+    d->registerObject(client, browser);
+    d->m_serviceBrowsers.insert(browser->serviceType, browser);
+    d->request(client);
+
+    foreach (const FakeAvahiNetwork::Service &service, d->m_services) {
+        if (service.serviceType == browser->serviceType) {
+            d->postService(browser, AVAHI_BROWSER_NEW, service);
+        }
+    }
+    d->postBrowserEvent(browser, AVAHI_BROWSER_CACHE_EXHAUSTED);
+    d->postBrowserEvent(browser, AVAHI_BROWSER_ALL_FOR_NOW);
+    return browser;
+}
+
+int avahi_service_browser_free(AvahiServiceBrowser *browser)
+{
+    FakeAvahiNetworkPrivate::get()->freeObject(browser);
+    return AVAHI_OK;
+}
+
+AvahiServiceResolver *avahi_service_resolver_new(AvahiClient *client, AvahiIfIndex interface, AvahiProtocol protocol, const char *name, const char *type, const char *domain, AvahiProtocol aprotocol, AvahiLookupFlags flags, AvahiServiceResolverCallback callback, void *userdata)
+{
+    Q_UNUSED(interface)
+    Q_UNUSED(protocol)
+    Q_UNUSED(domain)
+    Q_UNUSED(aprotocol)
+
+    FakeAvahiNetworkPrivate *d = FakeAvahiNetworkPrivate::get();
+    AvahiServiceResolver *resolver = new AvahiServiceResolver;
+    resolver->serviceType = QString::fromUtf8(type);
+    resolver->name = QString::fromUtf8(name);
+    resolver->flags = flags;
+    resolver->callback = callback;
+    resolver->userdata = userdata;
+    d->registerObject(client, resolver);
+    d->m_serviceResolvers.insert(FakeAvahiNetworkPrivate::serviceKey(resolver->serviceType, resolver->name), resolver);
+    d->request(client);
+
+    d->postResolve(resolver, d->m_resolveDelay);
+    return resolver;
+}
+
+int avahi_service_resolver_free(AvahiServiceResolver *resolver)
+{
+    FakeAvahiNetworkPrivate::get()->freeObject(resolver);
+    return AVAHI_OK;
+}
+
+AvahiHostNameResolver *avahi_host_name_resolver_new(AvahiClient *client, AvahiIfIndex interface, AvahiProtocol protocol, const char *name, AvahiProtocol aprotocol, AvahiLookupFlags flags, AvahiHostNameResolverCallback callback, void *userdata)
+{
+    Q_UNUSED(interface)
+    Q_UNUSED(protocol)
+    Q_UNUSED(aprotocol)
+    Q_UNUSED(flags)
+
+    FakeAvahiNetworkPrivate *d = FakeAvahiNetworkPrivate::get();
+    AvahiHostNameResolver *resolver = new AvahiHostNameResolver;
+    resolver->hostName = QString::fromUtf8(name);
+    resolver->callback = callback;
+    resolver->userdata = userdata;
+    d->registerObject(client, resolver);
+    d->request(client);
+
+    d->postHostNameResolve(resolver);
+    return resolver;
+}
+
+int avahi_host_name_resolver_free(AvahiHostNameResolver *resolver)
+{
+    FakeAvahiNetworkPrivate::get()->freeObject(resolver);
+    return AVAHI_OK;
+}
+
+AvahiEntryGroup *avahi_entry_group_new(AvahiClient *client, AvahiEntryGroupCallback callback, void *userdata)
+{
+    FakeAvahiNetworkPrivate *d = FakeAvahiNetworkPrivate::get();
+    AvahiEntryGroup *group = new AvahiEntryGroup;
+    group->callback = callback;
+    group->userdata = userdata;
+    d->registerObject(client, group);
+    d->request(client);
+    return group;
+}
+
+int avahi_entry_group_free(AvahiEntryGroup *group)
+{
+    FakeAvahiNetworkPrivate::get()->freeObject(group);
+    return AVAHI_OK;
+}
+
+int avahi_entry_group_commit(AvahiEntryGroup *group)
+{
+    if (group->state != AVAHI_ENTRY_GROUP_UNCOMMITED) {
+        return AVAHI_ERR_BAD_STATE;
+    }
+
+    FakeAvahiNetworkPrivate *d = FakeAvahiNetworkPrivate::get();
+    d->request(group->client);
+    group->commit++;
+    group->state = AVAHI_ENTRY_GROUP_REGISTERING;
+    d->postGroupState(group, AVAHI_ENTRY_GROUP_REGISTERING);
+    d->postEstablish(group);
+    return AVAHI_OK;
+}
+
+int avahi_entry_group_reset(AvahiEntryGroup *group)
+{
+    FakeAvahiNetworkPrivate *d = FakeAvahiNetworkPrivate::get();
+    d->request(group->client);
+    d->withdrawGroup(group);
+    group->services.clear();
+    group->commit++;
+    group->state = AVAHI_ENTRY_GROUP_UNCOMMITED;
+    return AVAHI_OK;
+}
+
+int avahi_entry_group_is_empty(AvahiEntryGroup *group)
+{
+    return group->services.isEmpty();
+}
+
+int avahi_entry_group_add_service_strlst(AvahiEntryGroup *group, AvahiIfIndex interface, AvahiProtocol protocol, AvahiPublishFlags flags, const char *name, const char *type, const char *domain, const char *host, uint16_t port, AvahiStringList *txt)
+{
+    Q_UNUSED(interface)
+    Q_UNUSED(protocol)
+    Q_UNUSED(flags)
+    Q_UNUSED(domain)
+
+    FakeAvahiNetwork::Service service;
+    service.name = QString::fromUtf8(name);
+    service.serviceType = QString::fromUtf8(type);
+    service.hostName = host ? QString::fromUtf8(host) : QStringLiteral("loadbenchmark.local");
+    service.hostAddress = QHostAddress(QHostAddress::LocalHost);
+    service.port = port;
+    for (AvahiStringList *item = txt; item; item = avahi_string_list_get_next(item)) {
+        service.txt.append(QString::fromUtf8(reinterpret_cast<const char*>(avahi_string_list_get_text(item)), avahi_string_list_get_size(item)));
+    }
+
+    foreach (const FakeAvahiNetwork::Service &other, group->services) {
+        if (other.serviceType == service.serviceType && other.name == service.name) {
+            return AVAHI_ERR_COLLISION;
+        }
+    }
+    FakeAvahiNetworkPrivate::get()->request(group->client);
+    group->services.append(service);
+    return AVAHI_OK;
+}
+
+int avahi_entry_group_update_service_txt_strlst(AvahiEntryGroup *group, AvahiIfIndex interface, AvahiProtocol protocol, AvahiPublishFlags flags, const char *name, const char *type, const char *domain, AvahiStringList *strlst)
+{
+    Q_UNUSED(interface)
+    Q_UNUSED(protocol)
+    Q_UNUSED(flags)
+    Q_UNUSED(domain)
+
+    QString serviceName = QString::fromUtf8(name);
+    QString serviceType = QString::fromUtf8(type);
+    for (int i = 0; i < group->services.count(); i++) {
+        FakeAvahiNetwork::Service &service = group->services[i];
+        if (service.serviceType != serviceType || service.name != serviceName) {
+            continue;
+        }
+
+        service.txt.clear();
+        for (AvahiStringList *item = strlst; item; item = avahi_string_list_get_next(item)) {
+            service.txt.append(QString::fromUtf8(reinterpret_cast<const char*>(avahi_string_list_get_text(item)), avahi_string_list_get_size(item)));
+        }
+
+        FakeAvahiNetworkPrivate *d = FakeAvahiNetworkPrivate::get();
+        d->request(group->client);
+        if (d->m_owners.value(FakeAvahiNetworkPrivate::serviceKey(serviceType, serviceName)) == group->id) {
+            FakeAvahiNetwork::instance()->updateServiceTxt(serviceType, serviceName, service.txt);
+        }
+        return AVAHI_OK;
+    }
+    return AVAHI_ERR_NOT_FOUND;
+}
@@ -0,0 +1,87 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* Copyright 2013 - 2020, nymea GmbH
+* Contact: contact@nymea.io
+*
+* This file is part of nymea.
+* This project including source code and documentation is protected by
+* copyright law, and remains the property of nymea GmbH. All rights, including
+* reproduction, publication, editing and translation, are reserved. The use of
+* this project is subject to the terms of a license agreement to be concluded
+* with nymea GmbH in accordance with the terms of use of nymea GmbH, available
+* under https://nymea.io/license
+*
+* GNU Lesser General Public License Usage
+* Alternatively, this project may be redistributed and/or modified under the
+* terms of the GNU Lesser General Public License as published by the Free
+* Software Foundation; version 3. This project is distributed in the hope that
+* it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+* warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this project. If not, see <https://www.gnu.org/licenses/>.
+*
+* For any further details and any questions please contact us under
+* contact@nymea.io or see our FAQ/Licensing Information on
+* https://nymea.io/license/faq
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef FAKEAVAHI_H
+#define FAKEAVAHI_H
+
+#include <QString>
+#include <QStringList>
+#include <QHostAddress>
+
+class FakeAvahiNetworkPrivate;
+
+// In-process stand-in for the avahi daemon. This benchmark links a fake libavahi-client
+// against it, clients talk to it through a socket pair watched on the poll they were
+// created with, so every event passes the poll adapter like a D-Bus message would.
+class FakeAvahiNetwork
+{
+public:
+    struct Service {
+        QString name;
+        QString serviceType;
+        QString hostName;
+        QHostAddress hostAddress;
+        quint16 port = 0;
+        QStringList txt;
+    };
+
+    static FakeAvahiNetwork *instance();
+
+    // Announced to all browsers of the type, a service with the same type and name is replaced
+    void addService(const Service &service);
+    bool removeService(const QString &serviceType, const QString &name);
+    // Reported again by the resolvers still running for the service
+    bool updateServiceTxt(const QString &serviceType, const QString &name, const QStringList &txt);
+    bool containsService(const QString &serviceType, const QString &name) const;
+    int serviceCount() const;
+
+    // Share of service and host name resolves reported as FAILURE
+    double resolveFailureRatio() const;
+    void setResolveFailureRatio(double resolveFailureRatio);
+    // Milliseconds until resolvers report, 0 answers with the next dispatch
+    int resolveDelay() const;
+    void setResolveDelay(int resolveDelay);
+    // Milliseconds from committing an entry group until it is ESTABLISHED
+    int establishDelay() const;
+    void setEstablishDelay(int establishDelay);
+
+    // Callbacks delivered to the clients and requests (object creation, commits...) received from them
+    quint64 deliveredEvents() const;
+    quint64 requests() const;
+
+private:
+    FakeAvahiNetwork();
+    ~FakeAvahiNetwork();
+
+    friend class FakeAvahiNetworkPrivate;
+    FakeAvahiNetworkPrivate *d;
+};
+
+#endif // FAKEAVAHI_H
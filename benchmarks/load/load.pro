@@ -0,0 +1,40 @@
+TEMPLATE = app
+TARGET = loadbenchmark
+
+QT -= gui
+QT += network
+
+QMAKE_CXXFLAGS *= -Wno-deprecated-declaration
+
+CONFIG += console link_pkgconfig c++11
+CONFIG -= app_bundle
+# fakeavahi.cpp replaces libavahi-client, only the common part is linked
+PKGCONFIG += nymea
+LIBS += -lavahi-common
+
+INCLUDEPATH += ../..
+
+SOURCES += main.cpp \
+    allocationcounter.cpp \
+    fakeavahi.cpp \
+    loadgenerator.cpp \
+    ../../qtavahiclient.cpp \
+    ../../qtavahiinterfacecache.cpp \
+    ../../qtavahiservicebrowser.cpp \
+    ../../qtavahiserviceentrystore.cpp \
+    ../../qtavahistatistics.cpp \
+    ../../qtavahiservicepublisher.cpp \
+    ../../zeroconfservicebrowseravahi.cpp \
+    ../../qt-watch.cpp \
+
+HEADERS += allocationcounter.h \
+    fakeavahi.h \
+    loadgenerator.h \
+    ../../qtavahiclient.h \
+    ../../qtavahiinterfacecache.h \
+    ../../qtavahiservicebrowser.h \
+    ../../qtavahiserviceentrystore.h \
+    ../../qtavahistatistics.h \
+    ../../qtavahiservicepublisher.h \
+    ../../zeroconfservicebrowseravahi.h \
+    ../../qt-watch.h \
@@ -0,0 +1,177 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* Copyright 2013 - 2020, nymea GmbH
+* Contact: contact@nymea.io
+*
+* This file is part of nymea.
+* This project including source code and documentation is protected by
+* copyright law, and remains the property of nymea GmbH. All rights, including
+* reproduction, publication, editing and translation, are reserved. The use of
+* this project is subject to the terms of a license agreement to be concluded
+* with nymea GmbH in accordance with the terms of use of nymea GmbH, available
+* under https://nymea.io/license
+*
+* GNU Lesser General Public License Usage
+* Alternatively, this project may be redistributed and/or modified under the
+* terms of the GNU Lesser General Public License as published by the Free
+* Software Foundation; version 3. This project is distributed in the hope that
+* it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+* warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this project. If not, see <https://www.gnu.org/licenses/>.
+*
+* For any further details and any questions please contact us under
+* contact@nymea.io or see our FAQ/Licensing Information on
+* https://nymea.io/license/faq
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include "loadgenerator.h"
+#include "qtavahiservicepublisher.h"
+
+#include <QRandomGenerator>
+
+LoadGenerator::LoadGenerator(QObject *parent) :
+    QObject(parent)
+{
+    m_timer.setInterval(10);
+    connect(&m_timer, &QTimer::timeout, this, &LoadGenerator::tick);
+}
+
+QString LoadGenerator::serviceType(int index)
+{
+    return QString("_loadbenchmark-%1._tcp").arg(index);
+}
+
+QString LoadGenerator::publishedServiceType()
+{
+    return QStringLiteral("_loadbenchmark-published._tcp");
+}
+
+void LoadGenerator::populate(int types, int instances)
+{
+    m_types = types;
+    for (int type = 0; type < types; type++) {
+        for (int instance = 0; instance < instances; instance++) {
+            FakeAvahiNetwork::Service service = createService(serviceType(type));
+            FakeAvahiNetwork::instance()->addService(service);
+            m_services.append(service);
+        }
+    }
+}
+
+void LoadGenerator::publish(QtAvahiServicePublisher *publisher, int services)
+{
+    m_publisher = publisher;
+    for (int i = 0; i < services; i++) {
+        QString name = QString("loadbenchmark-%1").arg(i);
+        QHash<QString, QString> txtRecords;
+        txtRecords.insert("id", QString::number(i));
+        txtRecords.insert("seq", "0");
+        if (m_publisher->registerService(name, QHostAddress("0.0.0.0"), 2000 + i, publishedServiceType(), txtRecords)) {
+            m_publishedServices.append(name);
+        }
+    }
+}
+
+void LoadGenerator::start(const Rates &rates)
+{
+    m_rates = rates;
+    m_tickTimer.start();
+    m_timer.start();
+}
+
+void LoadGenerator::stop()
+{
+    m_timer.stop();
+}
+
+quint64 LoadGenerator::operations() const
+{
+    return m_operations;
+}
+
+void LoadGenerator::tick()
+{
+    double elapsed = m_tickTimer.restart() / 1000.0;
+    m_pendingAdds += m_rates.addRate * elapsed;
+    m_pendingRemoves += m_rates.removeRate * elapsed;
+    m_pendingFlaps += m_rates.flapRate * elapsed;
+    m_pendingTxtUpdates += m_rates.txtUpdateRate * elapsed;
+    m_pendingPublishUpdates += m_rates.publishUpdateRate * elapsed;
+
+    FakeAvahiNetwork *network = FakeAvahiNetwork::instance();
+    QRandomGenerator *random = QRandomGenerator::global();
+
+    for (int i = consume(m_pendingAdds); i > 0 && m_types > 0; i--) {
+        FakeAvahiNetwork::Service service = createService(serviceType(random->bounded(m_types)));
+        network->addService(service);
+        m_services.append(service);
+        m_operations++;
+    }
+
+    for (int i = consume(m_pendingRemoves); i > 0 && !m_services.isEmpty(); i--) {
+        FakeAvahiNetwork::Service service = takeRandomService();
+        network->removeService(service.serviceType, service.name);
+        m_operations++;
+    }
+
+    for (int i = consume(m_pendingFlaps); i > 0 && !m_services.isEmpty(); i--) {
+        FakeAvahiNetwork::Service service = takeRandomService();
+        network->removeService(service.serviceType, service.name);
+        QTimer::singleShot(m_rates.flapPeriod, this, [this, service]() {
+            FakeAvahiNetwork::instance()->addService(service);
+            m_services.append(service);
+        });
+        m_operations++;
+    }
+
+    for (int i = consume(m_pendingTxtUpdates); i > 0 && !m_services.isEmpty(); i--) {
+        FakeAvahiNetwork::Service &service = m_services[random->bounded(m_services.count())];
+        service.txt.last() = QString("seq=%1").arg(++m_txtSequence);
+        network->updateServiceTxt(service.serviceType, service.name, service.txt);
+        m_operations++;
+    }
+
+    for (int i = consume(m_pendingPublishUpdates); i > 0 && !m_publishedServices.isEmpty(); i--) {
+        QString name = m_publishedServices.at(random->bounded(m_publishedServices.count()));
+        QHash<QString, QString> txtRecords;
+        txtRecords.insert("id", name.section('-', -1));
+        txtRecords.insert("seq", QString::number(++m_txtSequence));
+        m_publisher->updateServiceTxt(name, txtRecords);
+        m_operations++;
+    }
+}
+
+FakeAvahiNetwork::Service LoadGenerator::createService(const QString &serviceType)
+{
+    quint64 instance = m_nextInstance++;
+    int host = instance % s_hostCount;
+
+    FakeAvahiNetwork::Service service;
+    service.name = QString("instance-%1").arg(instance);
+    service.serviceType = serviceType;
+    service.hostName = QString("host-%1.local").arg(host);
+    service.hostAddress = QHostAddress(QString("10.0.%1.%2").arg(host / 254).arg(host % 254 + 1));
+    service.port = 1000 + instance % 1000;
+    service.txt << QString("id=%1").arg(instance) << "model=loadbenchmark" << "seq=0";
+    return service;
+}
+
+FakeAvahiNetwork::Service LoadGenerator::takeRandomService()
+{
+    int index = QRandomGenerator::global()->bounded(m_services.count());
+    FakeAvahiNetwork::Service service = m_services.at(index);
+    m_services[index] = m_services.last();
+    m_services.removeLast();
+    return service;
+}
+
+int LoadGenerator::consume(double &pending)
+{
+    int count = static_cast<int>(pending);
+    pending -= count;
+    return count;
+}
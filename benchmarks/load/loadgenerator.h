@@ -0,0 +1,104 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* Copyright 2013 - 2020, nymea GmbH
+* Contact: contact@nymea.io
+*
+* This file is part of nymea.
+* This project including source code and documentation is protected by
+* copyright law, and remains the property of nymea GmbH. All rights, including
+* reproduction, publication, editing and translation, are reserved. The use of
+* this project is subject to the terms of a license agreement to be concluded
+* with nymea GmbH in accordance with the terms of use of nymea GmbH, available
+* under https://nymea.io/license
+*
+* GNU Lesser General Public License Usage
+* Alternatively, this project may be redistributed and/or modified under the
+* terms of the GNU Lesser General Public License as published by the Free
+* Software Foundation; version 3. This project is distributed in the hope that
+* it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+* warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this project. If not, see <https://www.gnu.org/licenses/>.
+*
+* For any further details and any questions please contact us under
+* contact@nymea.io or see our FAQ/Licensing Information on
+* https://nymea.io/license/faq
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef LOADGENERATOR_H
+#define LOADGENERATOR_H
+
+#include <QObject>
+#include <QTimer>
+#include <QVector>
+#include <QElapsedTimer>
+
+#include "fakeavahi.h"
+
+class QtAvahiServicePublisher;
+
+// Changes the services of the fake network and of a publisher at given rates
+class LoadGenerator : public QObject
+{
+    Q_OBJECT
+public:
+    // All rates are per second
+    struct Rates {
+        double addRate = 0;
+        double removeRate = 0;
+        // Services removed and announced again after the flap period
+        double flapRate = 0;
+        int flapPeriod = 500;
+        double txtUpdateRate = 0;
+        double publishUpdateRate = 0;
+    };
+
+    explicit LoadGenerator(QObject *parent = nullptr);
+
+    static QString serviceType(int index);
+    static QString publishedServiceType();
+
+    // Injects instances services of each of the types into the fake network
+    void populate(int types, int instances);
+    // Registers services with the publisher, their TXT records are updated at the publish update rate
+    void publish(QtAvahiServicePublisher *publisher, int services);
+
+    void start(const Rates &rates);
+    void stop();
+
+    quint64 operations() const;
+
+private:
+    void tick();
+    FakeAvahiNetwork::Service createService(const QString &serviceType);
+    FakeAvahiNetwork::Service takeRandomService();
+    static int consume(double &pending);
+
+    // Hosts the injected services are spread over, so host lookups and the host cache get reused
+    static const int s_hostCount = 1024;
+
+    QTimer m_timer;
+    QElapsedTimer m_tickTimer;
+    Rates m_rates;
+    double m_pendingAdds = 0;
+    double m_pendingRemoves = 0;
+    double m_pendingFlaps = 0;
+    double m_pendingTxtUpdates = 0;
+    double m_pendingPublishUpdates = 0;
+
+    int m_types = 0;
+    quint64 m_nextInstance = 0;
+    quint64 m_txtSequence = 0;
+    // Announced services which are not flapping at the moment
+    QVector<FakeAvahiNetwork::Service> m_services;
+
+    QtAvahiServicePublisher *m_publisher = nullptr;
+    QStringList m_publishedServices;
+
+    quint64 m_operations = 0;
+};
+
+#endif // LOADGENERATOR_H
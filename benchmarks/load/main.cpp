@@ -0,0 +1,331 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* Copyright 2013 - 2020, nymea GmbH
+* Contact: contact@nymea.io
+*
+* This file is part of nymea.
+* This project including source code and documentation is protected by
+* copyright law, and remains the property of nymea GmbH. All rights, including
+* reproduction, publication, editing and translation, are reserved. The use of
+* this project is subject to the terms of a license agreement to be concluded
+* with nymea GmbH in accordance with the terms of use of nymea GmbH, available
+* under https://nymea.io/license
+*
+* GNU Lesser General Public License Usage
+* Alternatively, this project may be redistributed and/or modified under the
+* terms of the GNU Lesser General Public License as published by the Free
+* Software Foundation; version 3. This project is distributed in the hope that
+* it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+* warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this project. If not, see <https://www.gnu.org/licenses/>.
+*
+* For any further details and any questions please contact us under
+* contact@nymea.io or see our FAQ/Licensing Information on
+* https://nymea.io/license/faq
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QLoggingCategory>
+#include <QElapsedTimer>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTextStream>
+#include <QTimer>
+#include <QFile>
+
+#include <algorithm>
+#include <sys/resource.h>
+
+#include "qtavahiclient.h"
+#include "qtavahiservicebrowser.h"
+#include "qtavahiservicepublisher.h"
+#include "qtavahistatistics.h"
+#include "zeroconfservicebrowseravahi.h"
+
+#include "allocationcounter.h"
+#include "fakeavahi.h"
+#include "loadgenerator.h"
+
+// Lateness of a periodic timer, i.e. how long the main loop was kept from dispatching it
+class LoopLatencyProbe : public QObject
+{
+public:
+    explicit LoopLatencyProbe(int interval, QObject *parent = nullptr) :
+        QObject(parent),
+        m_interval(interval)
+    {
+        m_timer.setTimerType(Qt::PreciseTimer);
+        m_timer.setInterval(m_interval);
+        connect(&m_timer, &QTimer::timeout, this, [this]() {
+            qint64 lateness = m_elapsed.nsecsElapsed() / 1000 - m_interval * 1000;
+            m_elapsed.start();
+            m_samples.append(qMax<qint64>(lateness, 0));
+        });
+    }
+
+    void start()
+    {
+        m_samples.clear();
+        m_elapsed.start();
+        m_timer.start();
+    }
+
+    void stop()
+    {
+        m_timer.stop();
+        std::sort(m_samples.begin(), m_samples.end());
+    }
+
+    // Microseconds, once stopped
+    qint64 percentile(double percentile) const
+    {
+        if (m_samples.isEmpty()) {
+            return 0;
+        }
+        return m_samples.at(qMin(m_samples.count() - 1, static_cast<int>(m_samples.count() * percentile)));
+    }
+
+private:
+    int m_interval = 0;
+    QTimer m_timer;
+    QElapsedTimer m_elapsed;
+    QVector<qint64> m_samples;
+};
+
+static double perSecond(quint64 count, qint64 msecs)
+{
+    return msecs > 0 ? count * 1000.0 / msecs : 0;
+}
+
+static qint64 peakRss()
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) < 0) {
+        return 0;
+    }
+    return usage.ru_maxrss;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication application(argc, argv);
+    application.setApplicationName("loadbenchmark");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Drives the avahi browser and publisher with synthetic service churn from a fake avahi client.");
+    parser.addHelpOption();
+    QCommandLineOption typesOption("types", "Browsed service types.", "count", "10");
+    QCommandLineOption instancesOption("instances", "Services per type present before browsing.", "count", "50");
+    QCommandLineOption durationOption("duration", "Seconds of load after the initial scans finished.", "seconds", "10");
+    QCommandLineOption addRateOption("add-rate", "Services added per second.", "rate", "20");
+    QCommandLineOption removeRateOption("remove-rate", "Services removed per second.", "rate", "20");
+    QCommandLineOption flapRateOption("flap-rate", "Services removed and announced again per second.", "rate", "10");
+    QCommandLineOption flapPeriodOption("flap-period", "Milliseconds a flapping service is gone.", "msecs", "500");
+    QCommandLineOption txtRateOption("txt-update-rate", "TXT record changes of browsed services per second.", "rate", "10");
+    QCommandLineOption failureOption("failure-ratio", "Share of failing resolves.", "ratio", "0.05");
+    QCommandLineOption resolveDelayOption("resolve-delay", "Milliseconds until resolvers report.", "msecs", "0");
+    QCommandLineOption publishOption("publish", "Services registered with the publisher.", "count", "10");
+    QCommandLineOption publishRateOption("publish-update-rate", "TXT record changes of published services per second.", "rate", "2");
+    QCommandLineOption profileOption("profile", "Browse profile: full, txt, address or presence.", "profile", "full");
+    QCommandLineOption maxResolversOption("max-resolvers", "Concurrent resolvers.", "count", "16");
+    QCommandLineOption persistentOption("persistent-resolvers", "Keep resolvers running to report changes.");
+    QCommandLineOption hostCacheOption("host-cache", "Resolve service hosts through the host address cache.");
+    QCommandLineOption graceOption("grace-period", "Milliseconds removals are held back.", "msecs", "0");
+    QCommandLineOption coalescingOption("coalescing", "Milliseconds the subscribers collect changes.", "msecs", "0");
+    QCommandLineOption jsonOption("json", "Also write the results and backend statistics to the file.", "file");
+    QCommandLineOption verboseOption("verbose", "Keep the debug output of the plugin.");
+    parser.addOptions({ typesOption, instancesOption, durationOption, addRateOption, removeRateOption, flapRateOption, flapPeriodOption,
+                        txtRateOption, failureOption, resolveDelayOption, publishOption, publishRateOption, profileOption,
+                        maxResolversOption, persistentOption, hostCacheOption, graceOption, coalescingOption, jsonOption, verboseOption });
+    parser.process(application);
+
+    if (!parser.isSet(verboseOption)) {
+        // Logging would dominate the measurement
+        QLoggingCategory::setFilterRules("*.debug=false\n*.warning=false");
+    }
+
+    QtAvahiServiceBrowser::BrowseProfile browseProfile = QtAvahiServiceBrowser::BrowseProfileFull;
+    QString profile = parser.value(profileOption);
+    if (profile == "txt") {
+        browseProfile = QtAvahiServiceBrowser::BrowseProfileTxt;
+    } else if (profile == "address") {
+        browseProfile = QtAvahiServiceBrowser::BrowseProfileAddress;
+    } else if (profile == "presence") {
+        browseProfile = QtAvahiServiceBrowser::BrowseProfilePresence;
+    } else if (profile != "full") {
+        parser.showHelp(1);
+    }
+
+    int types = parser.value(typesOption).toInt();
+    int instances = parser.value(instancesOption).toInt();
+    int duration = parser.value(durationOption).toInt();
+
+    LoadGenerator::Rates rates;
+    rates.addRate = parser.value(addRateOption).toDouble();
+    rates.removeRate = parser.value(removeRateOption).toDouble();
+    rates.flapRate = parser.value(flapRateOption).toDouble();
+    rates.flapPeriod = parser.value(flapPeriodOption).toInt();
+    rates.txtUpdateRate = parser.value(txtRateOption).toDouble();
+    rates.publishUpdateRate = parser.value(publishRateOption).toDouble();
+
+    FakeAvahiNetwork *network = FakeAvahiNetwork::instance();
+    network->setResolveFailureRatio(parser.value(failureOption).toDouble());
+    network->setResolveDelay(parser.value(resolveDelayOption).toInt());
+
+    LoadGenerator generator;
+    generator.populate(types, instances);
+
+    quint64 startAllocations = allocationCount();
+    QElapsedTimer scanTimer;
+    scanTimer.start();
+
+    QtAvahiClient *client = new QtAvahiClient();
+    QtAvahiServiceBrowser *browser = new QtAvahiServiceBrowser(client);
+    browser->setMaxConcurrentResolvers(parser.value(maxResolversOption).toInt());
+    browser->setPersistentResolversEnabled(parser.isSet(persistentOption));
+    browser->setHostAddressCacheEnabled(parser.isSet(hostCacheOption));
+    browser->setRemovalGracePeriod(parser.value(graceOption).toInt());
+    QtAvahiServicePublisher *publisher = new QtAvahiServicePublisher(client);
+
+    quint64 browserEvents = 0;
+    QObject::connect(browser, &QtAvahiServiceBrowser::serviceAdded, [&browserEvents]() { browserEvents++; });
+    QObject::connect(browser, &QtAvahiServiceBrowser::serviceRemoved, [&browserEvents]() { browserEvents++; });
+    QObject::connect(browser, &QtAvahiServiceBrowser::serviceUpdated, [&browserEvents]() { browserEvents++; });
+
+    int maxResolveQueueDepth = 0;
+    int backlogCount = 0;
+    QObject::connect(browser, &QtAvahiServiceBrowser::resolveBacklogChanged, [&backlogCount](bool resolveBacklog) {
+        if (resolveBacklog) {
+            backlogCount++;
+        }
+    });
+
+    LoopLatencyProbe probe(5);
+    QTimer loadTimer;
+    loadTimer.setSingleShot(true);
+
+    qint64 scanTime = -1;
+    quint64 scanAllocations = 0;
+    quint64 loadAllocations = 0;
+    quint64 loadEvents = 0;
+    quint64 loadBrowserEvents = 0;
+    quint64 loadRequests = 0;
+    QElapsedTimer loadElapsed;
+    qint64 loadTime = 0;
+
+    auto startLoad = [&]() {
+        if (loadElapsed.isValid()) {
+            return;
+        }
+        scanAllocations = allocationCount() - startAllocations;
+        loadAllocations = allocationCount();
+        loadEvents = network->deliveredEvents();
+        loadBrowserEvents = browserEvents;
+        loadRequests = network->requests();
+        QtAvahiStatistics::instance()->reset();
+
+        generator.start(rates);
+        probe.start();
+        loadElapsed.start();
+        loadTimer.start(duration * 1000);
+    };
+
+    int scannedTypes = 0;
+    QList<ZeroConfServiceBrowserAvahi*> subscribers;
+    for (int i = 0; i < types; i++) {
+        ZeroConfServiceBrowserAvahi *subscriber = new ZeroConfServiceBrowserAvahi(browser, LoadGenerator::serviceType(i), browseProfile);
+        subscriber->setCoalescingInterval(parser.value(coalescingOption).toInt());
+        QObject::connect(subscriber, &ZeroConfServiceBrowserAvahi::initialScanFinished, [&]() {
+            if (++scannedTypes == types) {
+                scanTime = scanTimer.elapsed();
+                startLoad();
+            }
+        });
+        subscribers.append(subscriber);
+    }
+    generator.publish(publisher, parser.value(publishOption).toInt());
+
+    // Don't wait forever for scans which never finish
+    QTimer::singleShot(60000, startLoad);
+
+    QTimer queueTimer;
+    QObject::connect(&queueTimer, &QTimer::timeout, [&]() {
+        maxResolveQueueDepth = qMax(maxResolveQueueDepth, browser->resolveQueueDepth());
+    });
+    queueTimer.start(10);
+
+    QObject::connect(&loadTimer, &QTimer::timeout, [&]() {
+        generator.stop();
+        probe.stop();
+        queueTimer.stop();
+        loadTime = loadElapsed.elapsed();
+        loadAllocations = allocationCount() - loadAllocations;
+        loadEvents = network->deliveredEvents() - loadEvents;
+        loadBrowserEvents = browserEvents - loadBrowserEvents;
+        loadRequests = network->requests() - loadRequests;
+        application.quit();
+    });
+
+    application.exec();
+
+    QJsonObject results;
+    results.insert("types", types);
+    results.insert("instances", instances);
+    results.insert("services", network->serviceCount());
+    results.insert("entries", browser->entries().count());
+    results.insert("initialScanMs", scanTime);
+    results.insert("initialScanAllocations", static_cast<qint64>(scanAllocations));
+    results.insert("loadMs", loadTime);
+    results.insert("operations", static_cast<qint64>(generator.operations()));
+    results.insert("avahiEvents", static_cast<qint64>(loadEvents));
+    results.insert("avahiEventsPerSecond", perSecond(loadEvents, loadTime));
+    results.insert("avahiRequests", static_cast<qint64>(loadRequests));
+    results.insert("browserEvents", static_cast<qint64>(loadBrowserEvents));
+    results.insert("browserEventsPerSecond", perSecond(loadBrowserEvents, loadTime));
+    results.insert("loopLatencyP50Us", probe.percentile(0.5));
+    results.insert("loopLatencyP99Us", probe.percentile(0.99));
+    results.insert("loopLatencyMaxUs", probe.percentile(1));
+    results.insert("maxResolveQueueDepth", maxResolveQueueDepth);
+    results.insert("resolveBacklogs", backlogCount);
+    results.insert("peakRssKb", peakRss());
+    results.insert("allocations", static_cast<qint64>(loadAllocations));
+    results.insert("allocationsPerSecond", perSecond(loadAllocations, loadTime));
+    results.insert("allocationsPerAvahiEvent", loadEvents > 0 ? static_cast<double>(loadAllocations) / loadEvents : 0);
+
+    QTextStream out(stdout);
+    out << "services            " << types << " types x " << instances << " instances, " << network->serviceCount() << " at the end, " << results.value("entries").toInt() << " entries" << '\n';
+    if (scanTime < 0) {
+        out << "initial scan        not finished, load started after 60 s" << '\n';
+    } else {
+        out << "initial scan        " << scanTime << " ms, " << scanAllocations << " allocations" << '\n';
+    }
+    out << "load                " << loadTime << " ms, " << generator.operations() << " operations" << '\n';
+    out << "avahi events        " << loadEvents << " (" << qRound(perSecond(loadEvents, loadTime)) << "/s), " << loadRequests << " requests" << '\n';
+    out << "browser events      " << loadBrowserEvents << " (" << qRound(perSecond(loadBrowserEvents, loadTime)) << "/s)" << '\n';
+    out << "main loop latency   p50 " << probe.percentile(0.5) << " us, p99 " << probe.percentile(0.99) << " us, max " << probe.percentile(1) << " us" << '\n';
+    out << "resolve queue       max " << maxResolveQueueDepth << ", " << backlogCount << " backlogs" << '\n';
+    out << "peak RSS            " << peakRss() << " kB" << '\n';
+    out << "allocations         " << loadAllocations << " (" << qRound(perSecond(loadAllocations, loadTime)) << "/s, "
+        << QString::number(results.value("allocationsPerAvahiEvent").toDouble(), 'f', 1) << " per avahi event)" << '\n';
+
+    if (parser.isSet(jsonOption)) {
+        results.insert("statistics", QJsonObject::fromVariantMap(QtAvahiStatistics::instance()->toVariantMap()));
+        QFile file(parser.value(jsonOption));
+        if (!file.open(QFile::WriteOnly | QFile::Truncate)) {
+            out << "Could not write " << file.fileName() << ": " << file.errorString() << '\n';
+            return 1;
+        }
+        file.write(QJsonDocument(results).toJson());
+    }
+
+    qDeleteAll(subscribers);
+    delete publisher;
+    delete browser;
+    delete client;
+    return 0;
+}
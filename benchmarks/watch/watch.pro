@@ -0,0 +1,18 @@
+TEMPLATE = app
+TARGET = watchbenchmark
+
+QT -= gui
+QT += testlib
+
+CONFIG += testcase console link_pkgconfig c++11
+CONFIG -= app_bundle
+PKGCONFIG += avahi-client
+
+INCLUDEPATH += ../..
+
+SOURCES += watchbenchmark.cpp \
+    ../../qt-watch.cpp \
+    ../../qtavahistatistics.cpp \
+
+HEADERS += ../../qt-watch.h \
+    ../../qtavahistatistics.h \
@@ -0,0 +1,273 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* Copyright 2013 - 2020, nymea GmbH
+* Contact: contact@nymea.io
+*
+* This file is part of nymea.
+* This project including source code and documentation is protected by
+* copyright law, and remains the property of nymea GmbH. All rights, including
+* reproduction, publication, editing and translation, are reserved. The use of
+* this project is subject to the terms of a license agreement to be concluded
+* with nymea GmbH in accordance with the terms of use of nymea GmbH, available
+* under https://nymea.io/license
+*
+* GNU Lesser General Public License Usage
+* Alternatively, this project may be redistributed and/or modified under the
+* terms of the GNU Lesser General Public License as published by the Free
+* Software Foundation; version 3. This project is distributed in the hope that
+* it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+* warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this project. If not, see <https://www.gnu.org/licenses/>.
+*
+* For any further details and any questions please contact us under
+* contact@nymea.io or see our FAQ/Licensing Information on
+* https://nymea.io/license/faq
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <QtTest>
+#include <QObject>
+#include <QSocketNotifier>
+#include <QCoreApplication>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "qt-watch.h"
+
+// The poll adapter as it used to be, replacing the notifiers on every update.
+// Kept here as the reference the current adapter is measured against.
+class ReallocatingWatch : public QObject
+{
+    Q_OBJECT
+public:
+    ReallocatingWatch(int fd, AvahiWatchEvent event, AvahiWatchCallback callback, void *userdata) :
+        m_callback(callback),
+        m_fd(fd),
+        m_userdata(userdata)
+    {
+        setWatchedEvents(event);
+    }
+
+    AvahiWatchEvent getEvents() const { return m_incallback ? m_lastEvent : (AvahiWatchEvent)0; }
+
+    void setWatchedEvents(AvahiWatchEvent event)
+    {
+        // The old adapter leaked the previous notifiers if a bit stayed set, don't let that skew the numbers
+        delete m_in;
+        m_in = nullptr;
+        delete m_out;
+        m_out = nullptr;
+        if (event & AVAHI_WATCH_IN) {
+            m_in = new QSocketNotifier(m_fd, QSocketNotifier::Read, this);
+            connect(m_in, SIGNAL(activated(int)), SLOT(gotIn()));
+        }
+        if (event & AVAHI_WATCH_OUT) {
+            m_out = new QSocketNotifier(m_fd, QSocketNotifier::Write, this);
+            connect(m_out, SIGNAL(activated(int)), SLOT(gotOut()));
+        }
+    }
+
+private slots:
+    void gotIn() { dispatch(AVAHI_WATCH_IN); }
+    void gotOut() { dispatch(AVAHI_WATCH_OUT); }
+
+private:
+    void dispatch(AvahiWatchEvent event)
+    {
+        m_lastEvent = event;
+        m_incallback = true;
+        m_callback(reinterpret_cast<AvahiWatch*>(this), m_fd, m_lastEvent, m_userdata);
+        m_incallback = false;
+    }
+
+    QSocketNotifier *m_in = nullptr;
+    QSocketNotifier *m_out = nullptr;
+    AvahiWatchCallback m_callback;
+    AvahiWatchEvent m_lastEvent = (AvahiWatchEvent)0;
+    int m_fd;
+    void *m_userdata;
+    bool m_incallback = false;
+};
+
+static AvahiWatch *reallocating_watch_new(const AvahiPoll *api, int fd, AvahiWatchEvent event, AvahiWatchCallback callback, void *userdata)
+{
+    Q_UNUSED(api)
+    return reinterpret_cast<AvahiWatch*>(new ReallocatingWatch(fd, event, callback, userdata));
+}
+
+static void reallocating_watch_update(AvahiWatch *w, AvahiWatchEvent events)
+{
+    reinterpret_cast<ReallocatingWatch*>(w)->setWatchedEvents(events);
+}
+
+static AvahiWatchEvent reallocating_watch_get_events(AvahiWatch *w)
+{
+    return reinterpret_cast<ReallocatingWatch*>(w)->getEvents();
+}
+
+static void reallocating_watch_free(AvahiWatch *w)
+{
+    delete reinterpret_cast<ReallocatingWatch*>(w);
+}
+
+static const AvahiPoll *reallocating_poll_get()
+{
+    // Timeouts didn't change, only watches are benchmarked against it
+    static const AvahiPoll poll = {
+        nullptr,
+        reallocating_watch_new,
+        reallocating_watch_update,
+        reallocating_watch_get_events,
+        reallocating_watch_free,
+        avahi_qt_poll_get()->timeout_new,
+        avahi_qt_poll_get()->timeout_update,
+        avahi_qt_poll_get()->timeout_free
+    };
+    return &poll;
+}
+
+// Mimics the D-Bus socket of the avahi client: watches for OUT while there's something to send,
+// stops as soon as it's been sent, and drains whatever arrives.
+struct WatchContext {
+    const AvahiPoll *poll = nullptr;
+    int inEvents = 0;
+    int outEvents = 0;
+};
+
+static void watchCallback(AvahiWatch *w, int fd, AvahiWatchEvent event, void *userdata)
+{
+    WatchContext *context = static_cast<WatchContext*>(userdata);
+    if (event & AVAHI_WATCH_IN) {
+        char buffer[64];
+        while (read(fd, buffer, sizeof(buffer)) == static_cast<ssize_t>(sizeof(buffer))) { }
+        context->inEvents++;
+    }
+    if (event & AVAHI_WATCH_OUT) {
+        context->outEvents++;
+        context->poll->watch_update(w, AVAHI_WATCH_IN);
+    }
+}
+
+class WatchBenchmark : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void updateStorm_data();
+    void updateStorm();
+
+    void updateStormDispatched_data();
+    void updateStormDispatched();
+
+    void readDispatch_data();
+    void readDispatch();
+
+private:
+    void addAdapterRows();
+    const AvahiPoll *adapter(int index) const;
+
+    int m_fds[2] = { -1, -1 };
+};
+
+void WatchBenchmark::initTestCase()
+{
+    QCOMPARE(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, m_fds), 0);
+}
+
+void WatchBenchmark::cleanupTestCase()
+{
+    close(m_fds[0]);
+    close(m_fds[1]);
+}
+
+void WatchBenchmark::addAdapterRows()
+{
+    QTest::addColumn<int>("adapter");
+    QTest::newRow("notifiers kept") << 0;
+    QTest::newRow("notifiers reallocated") << 1;
+}
+
+const AvahiPoll *WatchBenchmark::adapter(int index) const
+{
+    return index == 0 ? avahi_qt_poll_get() : reallocating_poll_get();
+}
+
+void WatchBenchmark::updateStorm_data()
+{
+    addAdapterRows();
+}
+
+void WatchBenchmark::updateStorm()
+{
+    // Toggling OUT without ever getting back to the event loop, like a burst of outgoing messages
+    QFETCH(int, adapter);
+    WatchContext context;
+    context.poll = this->adapter(adapter);
+    AvahiWatch *watch = context.poll->watch_new(context.poll, m_fds[0], AVAHI_WATCH_IN, watchCallback, &context);
+
+    QBENCHMARK {
+        context.poll->watch_update(watch, (AvahiWatchEvent)(AVAHI_WATCH_IN | AVAHI_WATCH_OUT));
+        context.poll->watch_update(watch, AVAHI_WATCH_IN);
+    }
+
+    context.poll->watch_free(watch);
+}
+
+void WatchBenchmark::updateStormDispatched_data()
+{
+    addAdapterRows();
+}
+
+void WatchBenchmark::updateStormDispatched()
+{
+    // Each message waits for the socket to become writable, the callback stops watching for OUT again
+    QFETCH(int, adapter);
+    WatchContext context;
+    context.poll = this->adapter(adapter);
+    AvahiWatch *watch = context.poll->watch_new(context.poll, m_fds[0], AVAHI_WATCH_IN, watchCallback, &context);
+
+    QBENCHMARK {
+        context.poll->watch_update(watch, (AvahiWatchEvent)(AVAHI_WATCH_IN | AVAHI_WATCH_OUT));
+        QCoreApplication::processEvents();
+    }
+    QVERIFY(context.outEvents > 0);
+
+    context.poll->watch_free(watch);
+}
+
+void WatchBenchmark::readDispatch_data()
+{
+    addAdapterRows();
+}
+
+void WatchBenchmark::readDispatch()
+{
+    // Latency from data arriving on the socket until the avahi callback got it
+    QFETCH(int, adapter);
+    WatchContext context;
+    context.poll = this->adapter(adapter);
+    AvahiWatch *watch = context.poll->watch_new(context.poll, m_fds[0], AVAHI_WATCH_IN, watchCallback, &context);
+
+    QBENCHMARK {
+        int inEvents = context.inEvents;
+        char byte = 0;
+        QCOMPARE(write(m_fds[1], &byte, 1), static_cast<ssize_t>(1));
+        for (int i = 0; i < 1000 && context.inEvents == inEvents; i++) {
+            QCoreApplication::processEvents();
+        }
+        QVERIFY(context.inEvents > inEvents);
+    }
+
+    context.poll->watch_free(watch);
+}
+
+QTEST_GUILESS_MAIN(WatchBenchmark)
+
+#include "watchbenchmark.moc"
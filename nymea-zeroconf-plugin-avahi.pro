@@ -11,7 +11,10 @@ PKGCONFIG += nymea avahi-client
 
 SOURCES += platformzeroconfcontrolleravahi.cpp \
     qtavahiclient.cpp \
+    qtavahiinterfacecache.cpp \
     qtavahiservicebrowser.cpp \
+    qtavahiserviceentrystore.cpp \
+    qtavahistatistics.cpp \
     qtavahiservicepublisher.cpp \
     zeroconfservicepublisheravahi.cpp \
     zeroconfservicebrowseravahi.cpp \
@@ -19,7 +22,10 @@ SOURCES += platformzeroconfcontrolleravahi.cpp \
 
 HEADERS += platformzeroconfcontrolleravahi.h \
     qtavahiclient.h \
+    qtavahiinterfacecache.h \
     qtavahiservicebrowser.h \
+    qtavahiserviceentrystore.h \
+    qtavahistatistics.h \
     qtavahiservicepublisher.h \
     zeroconfservicepublisheravahi.h \
     zeroconfservicebrowseravahi.h \
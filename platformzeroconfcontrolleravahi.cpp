@@ -31,25 +31,106 @@
 #include "platformzeroconfcontrolleravahi.h"
 #include "zeroconfservicebrowseravahi.h"
 #include "zeroconfservicepublisheravahi.h"
+#include "qtavahistatistics.h"
+
+#include <nymeasettings.h>
+#include <loggingcategories.h>
+
+#include <QThread>
+#include <QJsonDocument>
 
 PlatformZeroConfPluginControllerAvahi::PlatformZeroConfPluginControllerAvahi(QObject *parent):
     PlatformZeroConfController(parent)
 {
-    m_avahiClient = new QtAvahiClient(this);
-    m_avahiServiceBrowser = new QtAvahiServiceBrowser(m_avahiClient, this);
-    m_avahiServicePublisher = new QtAvahiServicePublisher(m_avahiClient, this);
+    NymeaSettings settings(NymeaSettings::SettingsRoleGlobal);
+    settings.beginGroup("ZeroConf");
+    bool workerThread = settings.value("workerThread", false).toBool();
+    int statisticsInterval = settings.value("statisticsInterval", 0).toInt();
+    settings.endGroup();
+
+    // Backend signals are queued over from the avahi thread
+    qRegisterMetaType<AvahiClientState>("AvahiClientState");
+    // Returned by invokable lookups of the browsers
+    qRegisterMetaType<QList<ZeroConfServiceEntry>>("QList<ZeroConfServiceEntry>");
+    // Lets string based connections and invokeMethod() use the health, and QVariant::toInt() read the property
+    qRegisterMetaType<PlatformZeroConfPluginControllerAvahi::Health>("PlatformZeroConfPluginControllerAvahi::Health");
+    if (!QMetaType::hasRegisteredConverterFunction<PlatformZeroConfPluginControllerAvahi::Health, int>()) {
+        QMetaType::registerConverter<PlatformZeroConfPluginControllerAvahi::Health, int>([](PlatformZeroConfPluginControllerAvahi::Health health) {
+            return static_cast<int>(health);
+        });
+    }
+
+    if (workerThread) {
+        // The avahi client, its watches and timeouts as well as the browser and publisher state
+        // live in their own thread and only hand over results to the main thread.
+        qCDebug(dcPlatformZeroConf()) << "Running avahi client in a worker thread";
+        m_avahiThread = new QThread(this);
+        m_avahiThread->setObjectName("avahi");
+        m_avahiThread->start();
+
+        m_avahiContext = new QObject();
+        m_avahiContext->moveToThread(m_avahiThread);
+        QMetaObject::invokeMethod(m_avahiContext, [this](){ createBackend(nullptr); }, Qt::BlockingQueuedConnection);
+    } else {
+        createBackend(this);
+    }
 
     m_servicePublisher = new ZeroConfServicePublisherAvahi(m_avahiServicePublisher, this);
+
+    connect(m_avahiClient, &QtAvahiClient::stateChanged, this, [this](AvahiClientState state){
+        m_clientState = state;
+        updateHealth();
+    });
+    connect(m_avahiServiceBrowser, &QtAvahiServiceBrowser::resolveBacklogChanged, this, [this](bool resolveBacklog){
+        m_resolveBacklog = resolveBacklog;
+        updateHealth();
+    });
+    // The backend might have moved on before we got connected, changes from now on are queued to us in order
+    QMetaObject::invokeMethod(m_avahiClient, [this](){
+        m_clientState = m_avahiClient->state();
+        m_resolveBacklog = m_avahiServiceBrowser->resolveBacklog();
+    }, m_avahiThread ? Qt::BlockingQueuedConnection : Qt::DirectConnection);
+    updateHealth();
+
+    if (statisticsInterval > 0) {
+        connect(&m_statisticsTimer, &QTimer::timeout, this, &PlatformZeroConfPluginControllerAvahi::dumpStatistics);
+        m_statisticsTimer.start(statisticsInterval);
+    }
+}
+
+PlatformZeroConfPluginControllerAvahi::~PlatformZeroConfPluginControllerAvahi()
+{
+    // The publisher and browser use the client until they're gone, tear down in reverse order of creation
+    delete m_servicePublisher;
+    if (!m_avahiThread) {
+        delete m_avahiServicePublisher;
+        delete m_avahiServiceBrowser;
+        delete m_avahiClient;
+    } else {
+        QMetaObject::invokeMethod(m_avahiContext, [this](){
+            delete m_avahiServicePublisher;
+            delete m_avahiServiceBrowser;
+            delete m_avahiClient;
+        }, Qt::BlockingQueuedConnection);
+        m_avahiThread->quit();
+        m_avahiThread->wait();
+        delete m_avahiContext;
+    }
 }
 
 bool PlatformZeroConfPluginControllerAvahi::available() const
 {
-    return true;
+    return !m_health.testFlag(HealthBrowseDegraded);
 }
 
 bool PlatformZeroConfPluginControllerAvahi::enabled() const
 {
-    return true;
+    return !m_health.testFlag(HealthBrowseDegraded) && !m_health.testFlag(HealthPublishDegraded);
+}
+
+PlatformZeroConfPluginControllerAvahi::Health PlatformZeroConfPluginControllerAvahi::health() const
+{
+    return m_health;
 }
 
 ZeroConfServiceBrowser *PlatformZeroConfPluginControllerAvahi::createServiceBrowser(const QString &serviceType)
@@ -57,7 +138,100 @@ ZeroConfServiceBrowser *PlatformZeroConfPluginControllerAvahi::createServiceBrow
     return new ZeroConfServiceBrowserAvahi(m_avahiServiceBrowser, serviceType, this);
 }
 
+ZeroConfServiceBrowser *PlatformZeroConfPluginControllerAvahi::createServiceBrowser(const QString &serviceType, QtAvahiServiceBrowser::BrowseProfile browseProfile)
+{
+    return new ZeroConfServiceBrowserAvahi(m_avahiServiceBrowser, serviceType, browseProfile, this);
+}
+
+ZeroConfServiceBrowser *PlatformZeroConfPluginControllerAvahi::createServiceBrowser(const QString &serviceType, const QString &subtype, const QString &domain, QtAvahiServiceBrowser::BrowseProfile browseProfile)
+{
+    return new ZeroConfServiceBrowserAvahi(m_avahiServiceBrowser, serviceType, subtype, domain, browseProfile, this);
+}
+
+ZeroConfServiceBrowser *PlatformZeroConfPluginControllerAvahi::createScopedServiceBrowser(const QString &serviceType, const QString &subtype, const QString &domain, int browseProfile)
+{
+    return createServiceBrowser(serviceType, subtype, domain, QtAvahiServiceBrowser::BrowseProfile(browseProfile & QtAvahiServiceBrowser::BrowseProfileFull));
+}
+
 ZeroConfServicePublisher *PlatformZeroConfPluginControllerAvahi::servicePublisher() const
 {
     return m_servicePublisher;
 }
+
+QVariantMap PlatformZeroConfPluginControllerAvahi::statistics() const
+{
+    QVariantMap ret = QtAvahiStatistics::instance()->toVariantMap();
+
+    // The browser state belongs to the avahi thread
+    QVariantMap browser;
+    QMetaObject::invokeMethod(m_avahiServiceBrowser, [this, &browser](){
+        browser = m_avahiServiceBrowser->statistics();
+    }, m_avahiThread ? Qt::BlockingQueuedConnection : Qt::DirectConnection);
+    ret.insert("browser", browser);
+    return ret;
+}
+
+void PlatformZeroConfPluginControllerAvahi::dumpStatistics()
+{
+    qCDebug(dcPlatformZeroConf()) << "Statistics:" << QJsonDocument::fromVariant(statistics()).toJson(QJsonDocument::Compact).constData();
+}
+
+void PlatformZeroConfPluginControllerAvahi::updateHealth()
+{
+    Health health = HealthOk;
+    if (m_clientState != AVAHI_CLIENT_S_RUNNING && m_clientState != AVAHI_CLIENT_S_REGISTERING && m_clientState != AVAHI_CLIENT_S_COLLISION) {
+        health |= HealthBrowseDegraded;
+    }
+    if (m_clientState != AVAHI_CLIENT_S_RUNNING) {
+        health |= HealthPublishDegraded;
+    }
+    if (m_resolveBacklog) {
+        health |= HealthResolveBacklog;
+    }
+    if (health == m_health) {
+        return;
+    }
+
+    if (health == HealthOk) {
+        qCDebug(dcPlatformZeroConf()) << "ZeroConf backend recovered";
+    } else {
+        qCWarning(dcPlatformZeroConf()) << "ZeroConf backend degraded:" << health;
+    }
+    m_health = health;
+    emit healthChanged(m_health);
+}
+
+void PlatformZeroConfPluginControllerAvahi::createBackend(QObject *parent)
+{
+    m_avahiClient = new QtAvahiClient(parent);
+    m_avahiServiceBrowser = new QtAvahiServiceBrowser(m_avahiClient, parent);
+    m_avahiServicePublisher = new QtAvahiServicePublisher(m_avahiClient, parent);
+
+    NymeaSettings settings(NymeaSettings::SettingsRoleGlobal);
+    settings.beginGroup("ZeroConf");
+    m_avahiServiceBrowser->setMaxConcurrentResolvers(settings.value("maxConcurrentResolvers", m_avahiServiceBrowser->maxConcurrentResolvers()).toInt());
+    m_avahiServiceBrowser->setResolveBacklogThreshold(settings.value("resolveBacklogThreshold", m_avahiServiceBrowser->resolveBacklogThreshold()).toInt());
+    m_avahiServiceBrowser->setMaxResolveRetries(settings.value("maxResolveRetries", m_avahiServiceBrowser->maxResolveRetries()).toInt());
+    m_avahiServiceBrowser->setResolveRetryInterval(settings.value("resolveRetryInterval", m_avahiServiceBrowser->resolveRetryInterval()).toInt());
+    m_avahiServiceBrowser->setPersistentResolversEnabled(settings.value("persistentResolvers", m_avahiServiceBrowser->persistentResolversEnabled()).toBool());
+    m_avahiServiceBrowser->setHostAddressCacheEnabled(settings.value("hostAddressCache", m_avahiServiceBrowser->hostAddressCacheEnabled()).toBool());
+    if (settings.value("discoveryCache", false).toBool()) {
+        m_avahiServiceBrowser->setCacheFile(NymeaSettings::cachePath() + "/zeroconf-avahi.cache");
+    }
+    m_avahiServiceBrowser->setRemovalGracePeriod(settings.value("removalGracePeriod", m_avahiServiceBrowser->removalGracePeriod()).toInt());
+    m_avahiServiceBrowser->setEntryMaxAge(settings.value("entryMaxAge", m_avahiServiceBrowser->entryMaxAge()).toInt());
+    m_avahiServiceBrowser->setMaxEntriesPerType(settings.value("maxEntriesPerType", m_avahiServiceBrowser->maxEntriesPerType()).toInt());
+    QString protocol = settings.value("protocol", "any").toString();
+    if (protocol == "ipv4") {
+        m_avahiServiceBrowser->setProtocol(AVAHI_PROTO_INET);
+    } else if (protocol == "ipv6") {
+        m_avahiServiceBrowser->setProtocol(AVAHI_PROTO_INET6);
+    }
+    m_avahiServiceBrowser->setAllowedInterfaces(settings.value("interfaces").toStringList());
+    m_avahiServiceBrowser->setIgnoredInterfaces(settings.value("ignoredInterfaces").toStringList());
+    m_avahiServicePublisher->setDefaultRefreshInterval(settings.value("refreshInterval", m_avahiServicePublisher->defaultRefreshInterval()).toInt());
+    if (settings.value("refreshMode", "reregister").toString() == "announce") {
+        m_avahiServicePublisher->setRefreshMode(QtAvahiServicePublisher::RefreshModeAnnounce);
+    }
+    settings.endGroup();
+}
@@ -32,14 +32,18 @@
 #define PLATFORMZEROCONFCONTROLLERAVAHI_H
 
 #include <QObject>
+#include <QThread>
+#include <QTimer>
+#include <QVariantMap>
 
 #include <platform/platformzeroconfcontroller.h>
 
+#include "qtavahiservicebrowser.h"
+
 class ZeroConfServiceBrowserAvahi;
 class ZeroConfServicePublisherAvahi;
 
 class QtAvahiClient;
-class QtAvahiServiceBrowser;
 class QtAvahiServicePublisher;
 
 class PlatformZeroConfPluginControllerAvahi: public PlatformZeroConfController
@@ -47,21 +51,74 @@ class PlatformZeroConfPluginControllerAvahi: public PlatformZeroConfController
     Q_OBJECT
     Q_PLUGIN_METADATA(IID "io.nymea.PlatformZeroConfController")
     Q_INTERFACES(PlatformZeroConfController)
+    // Readable through the base class, property("health").toInt() gives the HealthFlag values
+    Q_PROPERTY(Health health READ health NOTIFY healthChanged)
 public:
+    // Parts of the backend which currently can't do their job
+    enum HealthFlag {
+        HealthOk = 0x00,
+        // Not connected to the avahi daemon, browsers won't deliver anything
+        HealthBrowseDegraded = 0x01,
+        // The daemon is not in running state, services can't be published right now
+        HealthPublishDegraded = 0x02,
+        // More services are waiting to be resolved than the configured threshold
+        HealthResolveBacklog = 0x04
+    };
+    Q_DECLARE_FLAGS(Health, HealthFlag)
+    Q_FLAG(Health)
+
     PlatformZeroConfPluginControllerAvahi(QObject *parent = nullptr);
+    ~PlatformZeroConfPluginControllerAvahi() override;
 
+    // Available while connected to the avahi daemon, enabled while it is fully running
     bool available() const override;
     bool enabled() const override;
 
+    Health health() const;
+
     ZeroConfServiceBrowser *createServiceBrowser(const QString &serviceType = QString()) override;
+    // Browsers only interested in parts of the services (e.g. presence only) save resolves
+    ZeroConfServiceBrowser *createServiceBrowser(const QString &serviceType, QtAvahiServiceBrowser::BrowseProfile browseProfile);
+    // Browses only the services of the type announced with the subtype (e.g. "_printer") and/or in the domain
+    ZeroConfServiceBrowser *createServiceBrowser(const QString &serviceType, const QString &subtype, const QString &domain, QtAvahiServiceBrowser::BrowseProfile browseProfile = QtAvahiServiceBrowser::BrowseProfileFull);
+    // The overloads above are not part of PlatformZeroConfController, plugins reach them through the meta object:
+    //   ZeroConfServiceBrowser *browser = nullptr;
+    //   QMetaObject::invokeMethod(controller, "createScopedServiceBrowser", Qt::DirectConnection, Q_RETURN_ARG(ZeroConfServiceBrowser*, browser),
+    //                             Q_ARG(QString, serviceType), Q_ARG(QString, subtype), Q_ARG(QString, domain), Q_ARG(int, browseProfile));
+    // invokeMethod() returns false on backends without it, fall back to createServiceBrowser() there.
+    Q_INVOKABLE ZeroConfServiceBrowser *createScopedServiceBrowser(const QString &serviceType, const QString &subtype, const QString &domain, int browseProfile);
     ZeroConfServicePublisher *servicePublisher() const override;
 
+    // Counters, latency histograms and gauges of the backend for debugging and monitoring
+    QVariantMap statistics() const;
+
+signals:
+    void healthChanged(PlatformZeroConfPluginControllerAvahi::Health health);
+
 private:
+    void createBackend(QObject *parent);
+    void dumpStatistics();
+    void updateHealth();
+
+    // Only set if the avahi client runs in a worker thread
+    QThread *m_avahiThread = nullptr;
+    QObject *m_avahiContext = nullptr;
+
     QtAvahiClient *m_avahiClient = nullptr;
     QtAvahiServiceBrowser *m_avahiServiceBrowser = nullptr;
     QtAvahiServicePublisher *m_avahiServicePublisher = nullptr;
 
     ZeroConfServicePublisherAvahi *m_servicePublisher = nullptr;
+
+    QTimer m_statisticsTimer;
+
+    // Mirrors of the backend state, updated from its signals
+    AvahiClientState m_clientState = AVAHI_CLIENT_CONNECTING;
+    bool m_resolveBacklog = false;
+    Health m_health = HealthOk;
 };
 
+Q_DECLARE_OPERATORS_FOR_FLAGS(PlatformZeroConfPluginControllerAvahi::Health)
+Q_DECLARE_METATYPE(PlatformZeroConfPluginControllerAvahi::Health)
+
 #endif // PLATFORMZEROCONFCONTROLLERAVAHI_H
@@ -23,11 +23,13 @@
 #include <QObject>
 #include <QTimer>
 #include <QSocketNotifier>
+#include <QElapsedTimer>
 
 #include <sys/time.h>
 #include <avahi-common/timeval.h>
 
 #include "qt-watch.h"
+#include "qtavahistatistics.h"
 
 class AvahiWatch : public QObject
 {
@@ -73,44 +75,49 @@ private:
 
 
 AvahiWatch::AvahiWatch(int fd, AvahiWatchEvent event, AvahiWatchCallback callback, void* userdata) :
-    m_in(0),
-    m_out(0),
+    m_in(new QSocketNotifier(fd, QSocketNotifier::Read, this)),
+    m_out(new QSocketNotifier(fd, QSocketNotifier::Write, this)),
     m_callback(callback),
+    m_lastEvent((AvahiWatchEvent)0),
     m_fd(fd),
     m_userdata(userdata),
     m_incallback(false)
 {
+    // The notifiers live as long as the watch, updates only enable or disable them
+    connect(m_in, SIGNAL(activated(int)), SLOT(gotIn()));
+    connect(m_out, SIGNAL(activated(int)), SLOT(gotOut()));
     setWatchedEvents(event);
 }
 
 void AvahiWatch::gotIn()
 {
+    QElapsedTimer timer;
+    timer.start();
     m_lastEvent = AVAHI_WATCH_IN;
     m_incallback = true;
     m_callback(this, m_fd, m_lastEvent, m_userdata);
     m_incallback = false;
+    QtAvahiStatistics::instance()->increment(QtAvahiStatistics::CounterWatchEvents);
+    QtAvahiStatistics::instance()->addSample(QtAvahiStatistics::HistogramWatchCallback, timer.nsecsElapsed() / 1000);
 }
 
 void AvahiWatch::gotOut()
 {
+    QElapsedTimer timer;
+    timer.start();
     m_lastEvent = AVAHI_WATCH_OUT;
     m_incallback = true;
     m_callback(this, m_fd, m_lastEvent, m_userdata);
     m_incallback = false;
+    QtAvahiStatistics::instance()->increment(QtAvahiStatistics::CounterWatchEvents);
+    QtAvahiStatistics::instance()->addSample(QtAvahiStatistics::HistogramWatchCallback, timer.nsecsElapsed() / 1000);
 }
 
 void AvahiWatch::setWatchedEvents(AvahiWatchEvent event)
 {
-    if (!(event & AVAHI_WATCH_IN)) { delete m_in; m_in = 0; }
-    if (!(event & AVAHI_WATCH_OUT)) { delete m_out; m_out = 0; }
-    if (event & AVAHI_WATCH_IN) {
-        m_in = new QSocketNotifier(m_fd,QSocketNotifier::Read, this);
-        connect(m_in, SIGNAL(activated(int)), SLOT(gotIn()));
-    }
-    if (event & AVAHI_WATCH_OUT) {
-        m_out = new QSocketNotifier(m_fd, QSocketNotifier::Write, this);
-        connect(m_out, SIGNAL(activated(int)), SLOT(gotOut()));
-    }
+    // QSocketNotifier::setEnabled() is a no-op if the state doesn't change
+    m_in->setEnabled(event & AVAHI_WATCH_IN);
+    m_out->setEnabled(event & AVAHI_WATCH_OUT);
 }
 
 AvahiTimeout::AvahiTimeout(const struct timeval* tv, AvahiTimeoutCallback callback, void *userdata) :
@@ -133,7 +140,12 @@ void AvahiTimeout::update(const struct timeval *tv)
 
 void AvahiTimeout::timeout()
 {
+    // The callback might free the timeout, don't touch it afterwards
+    QElapsedTimer timer;
+    timer.start();
     m_callback(this, m_userdata);
+    QtAvahiStatistics::instance()->increment(QtAvahiStatistics::CounterTimeouts);
+    QtAvahiStatistics::instance()->addSample(QtAvahiStatistics::HistogramTimeoutCallback, timer.nsecsElapsed() / 1000);
 }
 
 static AvahiWatch* q_watch_new(const AvahiPoll *api, int fd, AvahiWatchEvent event, AvahiWatchCallback callback, void *userdata)
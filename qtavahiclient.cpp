@@ -34,28 +34,100 @@
 
 #include "loggingcategories.h"
 
-QtAvahiClient::QtAvahiClient(QObject *parent) : QObject(parent)
+#include <avahi-common/error.h>
+
+QtAvahiClient::QtAvahiClient(QObject *parent) :
+    QtAvahiClient(avahi_qt_poll_get(), parent)
+{
+}
+
+QtAvahiClient::QtAvahiClient(const AvahiPoll *poll, QObject *parent) :
+    QObject(parent),
+    m_poll(poll)
+{
+    m_reconnectTimer.setSingleShot(true);
+    connect(&m_reconnectTimer, &QTimer::timeout, this, &QtAvahiClient::connectClient);
+
+    connectClient();
+}
+
+QtAvahiClient::~QtAvahiClient()
+{
+    if (m_client) {
+        emit aboutToReset();
+        avahi_client_free(m_client);
+    }
+}
+
+AvahiClientState QtAvahiClient::state() const
+{
+    if (!m_client) {
+        return AVAHI_CLIENT_FAILURE;
+    }
+    return avahi_client_get_state(m_client);
+}
+
+bool QtAvahiClient::isConnected() const
+{
+    AvahiClientState clientState = state();
+    return clientState == AVAHI_CLIENT_S_RUNNING || clientState == AVAHI_CLIENT_S_REGISTERING || clientState == AVAHI_CLIENT_S_COLLISION;
+}
+
+bool QtAvahiClient::isRunning() const
 {
+    return state() == AVAHI_CLIENT_S_RUNNING;
+}
+
+void QtAvahiClient::connectClient()
+{
+    // With AVAHI_CLIENT_NO_FAIL the client waits in AVAHI_CLIENT_CONNECTING for the daemon to show up
     int error = 0;
-    m_client = avahi_client_new(avahi_qt_poll_get(), (AvahiClientFlags) 0, QtAvahiClient::clientCallback, this, &error);
-    if (error != 0) {
-        qCWarning(dcPlatformZeroConf()) << "Error creating avahi client:" << error;
+    m_client = avahi_client_new(m_poll, AVAHI_CLIENT_NO_FAIL, QtAvahiClient::clientCallback, this, &error);
+    if (!m_client) {
+        qCWarning(dcPlatformZeroConf()) << "Error creating avahi client:" << avahi_strerror(error) << "Retrying in" << m_reconnectInterval << "ms";
+        m_reconnectTimer.start(m_reconnectInterval);
+        m_reconnectInterval = qMin(m_reconnectInterval * 2, 60000);
+        return;
     }
+    m_reconnectInterval = 1000;
+}
 
+void QtAvahiClient::resetClient()
+{
+    if (!m_client || avahi_client_get_state(m_client) != AVAHI_CLIENT_FAILURE) {
+        return;
+    }
+
+    qCDebug(dcPlatformZeroConf()) << "Resetting avahi client";
+    emit aboutToReset();
+    avahi_client_free(m_client);
+    m_client = nullptr;
+    emit stateChanged(AVAHI_CLIENT_FAILURE);
+
+    connectClient();
 }
 
 void QtAvahiClient::clientCallback(AvahiClient *client, AvahiClientState state, void *userdata)
 {
-    Q_UNUSED(client)
-    Q_UNUSED(userdata)
+    QtAvahiClient *instance = static_cast<QtAvahiClient*>(userdata);
+    // Might be called from within avahi_client_new() before it returned the client
+    instance->m_client = client;
+
     switch (state) {
     case AVAHI_CLIENT_S_RUNNING:
         qCDebug(dcPlatformZeroConf()) << "Connected to avahi";
         break;
+    case AVAHI_CLIENT_CONNECTING:
+        qCDebug(dcPlatformZeroConf()) << "Waiting for avahi daemon";
+        break;
     case AVAHI_CLIENT_FAILURE:
-        qCWarning(dcPlatformZeroConf()) << "Failed to connect to avahi";
+        qCWarning(dcPlatformZeroConf()) << "Failed to connect to avahi:" << avahi_strerror(avahi_client_errno(client));
+        // Freeing the client from within its own callback is not safe, do it from the event loop
+        QMetaObject::invokeMethod(instance, [instance](){ instance->resetClient(); }, Qt::QueuedConnection);
         break;
     default:
         ;
     }
+
+    emit instance->stateChanged(state);
 }
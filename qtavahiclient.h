@@ -32,6 +32,7 @@
 #define AVAHICLIENT_H
 
 #include <QObject>
+#include <QTimer>
 
 #include <avahi-client/client.h>
 
@@ -40,8 +41,23 @@ class QtAvahiClient : public QObject
     Q_OBJECT
 public:    
     explicit QtAvahiClient(QObject *parent = nullptr);
+    // Runs the client on the given poll implementation instead of the Qt event loop, e.g. to drive it from a load generator
+    explicit QtAvahiClient(const AvahiPoll *poll, QObject *parent = nullptr);
+    ~QtAvahiClient() override;
+
+    AvahiClientState state() const;
+    bool isConnected() const;
+    bool isRunning() const;
+
+signals:
+    void stateChanged(AvahiClientState state);
+    // The avahi client is about to be freed, all objects created with it must be dropped
+    void aboutToReset();
 
 private:
+    void connectClient();
+    void resetClient();
+
     static void clientCallback(AvahiClient *client, AvahiClientState state, void *userdata);
     static void serviceBrowserCallback();
 
@@ -49,6 +65,10 @@ private:
     friend class QtAvahiServiceBrowser;
     friend class QtAvahiServicePublisher;
     AvahiClient *m_client = nullptr;
+    const AvahiPoll *m_poll = nullptr;
+
+    QTimer m_reconnectTimer;
+    int m_reconnectInterval = 1000;
 };
 
 #endif // AVAHICLIENT_H
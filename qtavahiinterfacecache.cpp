@@ -0,0 +1,138 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* Copyright 2013 - 2020, nymea GmbH
+* Contact: contact@nymea.io
+*
+* This file is part of nymea.
+* This project including source code and documentation is protected by
+* copyright law, and remains the property of nymea GmbH. All rights, including
+* reproduction, publication, editing and translation, are reserved. The use of
+* this project is subject to the terms of a license agreement to be concluded
+* with nymea GmbH in accordance with the terms of use of nymea GmbH, available
+* under https://nymea.io/license
+*
+* GNU Lesser General Public License Usage
+* Alternatively, this project may be redistributed and/or modified under the
+* terms of the GNU Lesser General Public License as published by the Free
+* Software Foundation; version 3. This project is distributed in the hope that
+* it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+* warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this project. If not, see <https://www.gnu.org/licenses/>.
+*
+* For any further details and any questions please contact us under
+* contact@nymea.io or see our FAQ/Licensing Information on
+* https://nymea.io/license/faq
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include "qtavahiinterfacecache.h"
+
+#include <QNetworkInterface>
+
+#include <loggingcategories.h>
+
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+QtAvahiInterfaceCache::QtAvahiInterfaceCache(QObject *parent) : QObject(parent)
+{
+    // Netlink messages come in bursts when an interface changes, rebuild once they settled
+    m_rebuildTimer.setSingleShot(true);
+    m_rebuildTimer.setInterval(500);
+    connect(&m_rebuildTimer, &QTimer::timeout, this, &QtAvahiInterfaceCache::rebuild);
+
+    m_netlinkSocket = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (m_netlinkSocket >= 0) {
+        struct sockaddr_nl address;
+        memset(&address, 0, sizeof(address));
+        address.nl_family = AF_NETLINK;
+        address.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+        if (bind(m_netlinkSocket, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) < 0) {
+            qCWarning(dcPlatformZeroConf()) << "Failed to bind netlink socket:" << strerror(errno);
+            close(m_netlinkSocket);
+            m_netlinkSocket = -1;
+        }
+    } else {
+        qCWarning(dcPlatformZeroConf()) << "Failed to open netlink socket:" << strerror(errno);
+    }
+
+    if (m_netlinkSocket >= 0) {
+        m_netlinkNotifier = new QSocketNotifier(m_netlinkSocket, QSocketNotifier::Read, this);
+        connect(m_netlinkNotifier, SIGNAL(activated(int)), this, SLOT(onNetlinkActivated()));
+    } else {
+        // No change notifications available, fall back to polling
+        qCWarning(dcPlatformZeroConf()) << "Network changes are not monitored, polling network interfaces instead.";
+        m_rebuildTimer.setSingleShot(false);
+        m_rebuildTimer.setInterval(60000);
+        m_rebuildTimer.start();
+    }
+
+    rebuild();
+}
+
+QtAvahiInterfaceCache::~QtAvahiInterfaceCache()
+{
+    if (m_netlinkSocket >= 0) {
+        delete m_netlinkNotifier;
+        close(m_netlinkSocket);
+    }
+}
+
+AvahiIfIndex QtAvahiInterfaceCache::interfaceIndex(const QHostAddress &address) const
+{
+    foreach (const Subnet &subnet, m_subnets) {
+        if (address.isInSubnet(subnet.address, subnet.prefixLength)) {
+            return subnet.interfaceIndex;
+        }
+    }
+    return AVAHI_IF_UNSPEC;
+}
+
+void QtAvahiInterfaceCache::onNetlinkActivated()
+{
+    // We only care that something changed, drain everything and rebuild the table
+    char buffer[8192];
+    while (recv(m_netlinkSocket, buffer, sizeof(buffer), MSG_DONTWAIT) > 0) { }
+
+    if (!m_rebuildTimer.isActive()) {
+        m_rebuildTimer.start();
+    }
+}
+
+void QtAvahiInterfaceCache::rebuild()
+{
+    QList<Subnet> subnets;
+    foreach (const QNetworkInterface &interface, QNetworkInterface::allInterfaces()) {
+        foreach (const QNetworkAddressEntry &addressEntry, interface.addressEntries()) {
+            if (addressEntry.prefixLength() < 0) {
+                continue;
+            }
+            Subnet subnet;
+            subnet.address = addressEntry.ip();
+            subnet.prefixLength = addressEntry.prefixLength();
+            subnet.interfaceIndex = interface.index();
+            subnets.append(subnet);
+        }
+    }
+
+    if (subnets == m_subnets) {
+        return;
+    }
+
+    qCDebug(dcPlatformZeroConf()) << "Network interfaces changed. Now" << subnets.count() << "subnets available.";
+    m_subnets = subnets;
+    emit interfacesChanged();
+}
+
+bool QtAvahiInterfaceCache::Subnet::operator==(const Subnet &other) const
+{
+    return address == other.address && prefixLength == other.prefixLength && interfaceIndex == other.interfaceIndex;
+}
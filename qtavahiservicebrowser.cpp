@@ -29,6 +29,8 @@
 * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
 #include "qtavahiservicebrowser.h"
+#include "zeroconfservicebrowseravahi.h"
+#include "qtavahistatistics.h"
 
 #include <loggingcategories.h>
 
@@ -36,95 +38,1313 @@
 #include <avahi-common/error.h>
 
 #include <QTimer>
+#include <QDateTime>
+#include <QRandomGenerator>
+#include <QSaveFile>
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QNetworkInterface>
 
 QtAvahiServiceBrowser::QtAvahiServiceBrowser(QObject *parent): QObject(parent)
 {
     m_client = new QtAvahiClient(this);
-    m_serviceTypeBrowser = avahi_service_type_browser_new(m_client->m_client, AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC, 0, (AvahiLookupFlags) 0, QtAvahiServiceBrowser::serviceTypeBrowserCallback, this);
+    connect(m_client, &QtAvahiClient::stateChanged, this, &QtAvahiServiceBrowser::onClientStateChanged);
+    connect(m_client, &QtAvahiClient::aboutToReset, this, &QtAvahiServiceBrowser::onClientAboutToReset);
+    m_clientConnected = m_client->isConnected();
+    m_sweepTimer.setInterval(10000);
+    connect(&m_sweepTimer, &QTimer::timeout, this, &QtAvahiServiceBrowser::sweepEntries);
+    m_sweepTimer.start();
 }
 
 QtAvahiServiceBrowser::QtAvahiServiceBrowser(QtAvahiClient *client, QObject *parent):
     QObject(parent),
     m_client(client)
 {
-    m_serviceTypeBrowser = avahi_service_type_browser_new(m_client->m_client, AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC, 0, (AvahiLookupFlags) 0, QtAvahiServiceBrowser::serviceTypeBrowserCallback, this);
+    connect(m_client, &QtAvahiClient::stateChanged, this, &QtAvahiServiceBrowser::onClientStateChanged);
+    connect(m_client, &QtAvahiClient::aboutToReset, this, &QtAvahiServiceBrowser::onClientAboutToReset);
+    m_clientConnected = m_client->isConnected();
+    m_sweepTimer.setInterval(10000);
+    connect(&m_sweepTimer, &QTimer::timeout, this, &QtAvahiServiceBrowser::sweepEntries);
+    m_sweepTimer.start();
 }
 
 QtAvahiServiceBrowser::~QtAvahiServiceBrowser()
 {
-    foreach (AvahiServiceResolver *resolver, m_resolvers.toList()) {
+    // Browsers already gone (e.g. plugins shut down first) would leave us with a partial snapshot
+    if (!m_cacheFile.isEmpty() && (!m_subscriptions.isEmpty() || !m_wildcardSubscriptions.isEmpty())) {
+        saveCache();
+    }
+    freeAvahiObjects();
+}
+
+QList<ZeroConfServiceEntry> QtAvahiServiceBrowser::entries() const
+{
+    return m_entries.entries();
+}
+
+QList<ZeroConfServiceEntry> QtAvahiServiceBrowser::entries(const QString &serviceType) const
+{
+    return m_entries.entries(serviceType);
+}
+
+QList<ZeroConfServiceEntry> QtAvahiServiceBrowser::entries(const QString &serviceType, const QString &subtype, const QString &domain) const
+{
+    return m_entries.entries(serviceType, subtype, domain);
+}
+
+QList<ZeroConfServiceEntry> QtAvahiServiceBrowser::filterScope(const QList<ZeroConfServiceEntry> &entries, const QString &subtype, const QString &domain) const
+{
+    return m_entries.filterScope(entries, subtype, domain);
+}
+
+quint64 QtAvahiServiceBrowser::generation(const QString &serviceType) const
+{
+    return serviceType.isEmpty() ? m_entries.generation() : m_entries.generation(serviceType);
+}
+
+QList<ZeroConfServiceEntry> QtAvahiServiceBrowser::findByTxt(const QString &serviceType, const QString &txtKey, const QString &txtValue) const
+{
+    return m_entries.findByTxt(serviceType, txtKey, txtValue);
+}
+
+QList<ZeroConfServiceEntry> QtAvahiServiceBrowser::findByAddress(const QHostAddress &address, const QString &serviceType) const
+{
+    return m_entries.findByAddress(address, serviceType);
+}
+
+AvahiProtocol QtAvahiServiceBrowser::protocol() const
+{
+    return m_protocol;
+}
+
+void QtAvahiServiceBrowser::setProtocol(AvahiProtocol protocol)
+{
+    m_protocol = protocol;
+}
+
+QStringList QtAvahiServiceBrowser::allowedInterfaces() const
+{
+    return m_allowedInterfaces;
+}
+
+void QtAvahiServiceBrowser::setAllowedInterfaces(const QStringList &allowedInterfaces)
+{
+    m_allowedInterfaces.clear();
+    foreach (const QString &interfaceName, allowedInterfaces) {
+        m_allowedInterfaces.append(interfaceName.trimmed());
+    }
+}
+
+QStringList QtAvahiServiceBrowser::ignoredInterfaces() const
+{
+    return m_ignoredInterfaces;
+}
+
+void QtAvahiServiceBrowser::setIgnoredInterfaces(const QStringList &ignoredInterfaces)
+{
+    m_ignoredInterfaces.clear();
+    foreach (const QString &interfaceName, ignoredInterfaces) {
+        m_ignoredInterfaces.append(interfaceName.trimmed());
+    }
+}
+
+QList<int> QtAvahiServiceBrowser::interfaces(const ZeroConfServiceEntry &entry) const
+{
+    QList<int> ret;
+    foreach (AvahiIfIndex interface, m_entries.interfaces(QtAvahiServiceEntryStore::entryKey(entry))) {
+        ret.append(interface);
+    }
+    return ret;
+}
+
+QVariantMap QtAvahiServiceBrowser::statistics() const
+{
+    QVariantMap entries;
+    foreach (const QString &serviceType, m_entries.serviceTypes()) {
+        entries.insert(serviceType, m_entries.count(serviceType));
+    }
+
+    QVariantMap ret;
+    ret.insert("entries", entries);
+    ret.insert("activeResolvers", activeResolverCount());
+    ret.insert("persistentResolvers", persistentResolverCount());
+    ret.insert("resolveQueueDepth", resolveQueueDepth());
+    ret.insert("pendingResolveRetries", m_resolveRetries.count());
+    ret.insert("serviceBrowsers", m_serviceBrowsers.count());
+    ret.insert("hostResolvers", m_hostResolvers.count());
+    ret.insert("hostAddressCache", hostAddressCacheCount());
+    ret.insert("pendingRemovals", pendingRemovalCount());
+    ret.insert("absorbedRemovals", absorbedRemovalCount());
+    ret.insert("expiredRemovals", expiredRemovalCount());
+    return ret;
+}
+
+bool QtAvahiServiceBrowser::isSubtypeMember(const QString &subtype, const ZeroConfServiceEntry &entry) const
+{
+    return m_entries.hasSubtype(QtAvahiServiceEntryStore::entryKey(entry), subtype);
+}
+
+QString QtAvahiServiceBrowser::cacheFile() const
+{
+    return m_cacheFile;
+}
+
+void QtAvahiServiceBrowser::setCacheFile(const QString &cacheFile)
+{
+    m_cacheFile = cacheFile;
+    if (m_cacheFile.isEmpty()) {
+        m_cacheTimer.stop();
+        return;
+    }
+
+    loadCache();
+
+    m_cacheTimer.setInterval(300000);
+    connect(&m_cacheTimer, &QTimer::timeout, this, &QtAvahiServiceBrowser::saveCache, Qt::UniqueConnection);
+    m_cacheTimer.start();
+}
+
+bool QtAvahiServiceBrowser::saveCache() const
+{
+    QDir().mkpath(QFileInfo(m_cacheFile).absolutePath());
+    QSaveFile file(m_cacheFile);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qCWarning(dcPlatformZeroConf()) << "Failed to open ZeroConf cache file" << m_cacheFile << ":" << file.errorString();
+        return false;
+    }
+
+    QDataStream stream(&file);
+    m_entries.save(stream);
+    if (!file.commit()) {
+        qCWarning(dcPlatformZeroConf()) << "Failed to write ZeroConf cache file" << m_cacheFile << ":" << file.errorString();
+        return false;
+    }
+    qCDebug(dcPlatformZeroConf()) << "Saved" << m_entries.count() << "entries to" << m_cacheFile;
+    return true;
+}
+
+void QtAvahiServiceBrowser::loadCache()
+{
+    QFile file(m_cacheFile);
+    if (!file.exists()) {
+        return;
+    }
+    if (!file.open(QIODevice::ReadOnly)) {
+        qCWarning(dcPlatformZeroConf()) << "Failed to open ZeroConf cache file" << m_cacheFile << ":" << file.errorString();
+        return;
+    }
+
+    QDataStream stream(&file);
+    QList<QtAvahiServiceEntryStore::Key> keys = m_entries.load(stream);
+
+    // Served right away, but confirmed or evicted once browsing reports all-for-now, just like after a reconnect
+    foreach (const QtAvahiServiceEntryStore::Key &key, keys) {
+        m_staleEntries.insert(key);
+    }
+    qCDebug(dcPlatformZeroConf()) << "Loaded" << keys.count() << "entries from" << m_cacheFile;
+}
+
+int QtAvahiServiceBrowser::maxConcurrentResolvers() const
+{
+    return m_maxConcurrentResolvers;
+}
+
+void QtAvahiServiceBrowser::setMaxConcurrentResolvers(int maxConcurrentResolvers)
+{
+    m_maxConcurrentResolvers = qMax(1, maxConcurrentResolvers);
+    processResolveQueue();
+}
+
+int QtAvahiServiceBrowser::resolveQueueDepth() const
+{
+    return m_queuedResolves.count();
+}
+
+bool QtAvahiServiceBrowser::resolveBacklog() const
+{
+    return m_resolveBacklog;
+}
+
+int QtAvahiServiceBrowser::resolveBacklogThreshold() const
+{
+    return m_resolveBacklogThreshold;
+}
+
+void QtAvahiServiceBrowser::setResolveBacklogThreshold(int resolveBacklogThreshold)
+{
+    m_resolveBacklogThreshold = qMax(0, resolveBacklogThreshold);
+    updateResolveBacklog();
+}
+
+int QtAvahiServiceBrowser::activeResolverCount() const
+{
+    return m_resolvers.count() - m_persistentResolvers.count();
+}
+
+int QtAvahiServiceBrowser::persistentResolverCount() const
+{
+    return m_persistentResolvers.count();
+}
+
+bool QtAvahiServiceBrowser::persistentResolversEnabled() const
+{
+    return m_persistentResolversEnabled;
+}
+
+void QtAvahiServiceBrowser::setPersistentResolversEnabled(bool persistentResolversEnabled)
+{
+    m_persistentResolversEnabled = persistentResolversEnabled;
+    if (!m_persistentResolversEnabled) {
+        freePersistentResolvers();
+    }
+}
+
+int QtAvahiServiceBrowser::maxResolveRetries() const
+{
+    return m_maxResolveRetries;
+}
+
+void QtAvahiServiceBrowser::setMaxResolveRetries(int maxResolveRetries)
+{
+    m_maxResolveRetries = qMax(0, maxResolveRetries);
+}
+
+int QtAvahiServiceBrowser::resolveRetryInterval() const
+{
+    return m_resolveRetryInterval;
+}
+
+void QtAvahiServiceBrowser::setResolveRetryInterval(int resolveRetryInterval)
+{
+    m_resolveRetryInterval = qBound(100, resolveRetryInterval, m_maxResolveRetryInterval);
+}
+
+QStringList QtAvahiServiceBrowser::pendingResolveRetries() const
+{
+    QStringList ret;
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    for (QHash<QtAvahiServiceEntryStore::Key, ResolveRetry>::const_iterator it = m_resolveRetries.constBegin(); it != m_resolveRetries.constEnd(); ++it) {
+        ret.append(QString("%1 %2 (attempt %3/%4, next in %5 ms)").arg(it.key().type).arg(it.key().name).arg(it.value().attempt).arg(m_maxResolveRetries).arg(qMax<qint64>(0, it.value().dueTime - now)));
+    }
+    return ret;
+}
+
+bool QtAvahiServiceBrowser::hostAddressCacheEnabled() const
+{
+    return m_hostAddressCacheEnabled;
+}
+
+void QtAvahiServiceBrowser::setHostAddressCacheEnabled(bool hostAddressCacheEnabled)
+{
+    m_hostAddressCacheEnabled = hostAddressCacheEnabled;
+}
+
+int QtAvahiServiceBrowser::hostAddressCacheCount() const
+{
+    return m_hosts.count();
+}
+
+int QtAvahiServiceBrowser::removalGracePeriod() const
+{
+    return m_removalGracePeriod;
+}
+
+void QtAvahiServiceBrowser::setRemovalGracePeriod(int removalGracePeriod)
+{
+    m_removalGracePeriod = qMax(0, removalGracePeriod);
+}
+
+int QtAvahiServiceBrowser::pendingRemovalCount() const
+{
+    return m_pendingRemovals.count();
+}
+
+int QtAvahiServiceBrowser::absorbedRemovalCount() const
+{
+    return m_absorbedRemovalCount;
+}
+
+int QtAvahiServiceBrowser::expiredRemovalCount() const
+{
+    return m_expiredRemovalCount;
+}
+
+int QtAvahiServiceBrowser::entryMaxAge() const
+{
+    return m_entryMaxAge;
+}
+
+void QtAvahiServiceBrowser::setEntryMaxAge(int entryMaxAge)
+{
+    m_entryMaxAge = entryMaxAge;
+    if (m_entryMaxAge > 0) {
+        m_sweepTimer.start();
+    } else {
+        m_sweepTimer.stop();
+        m_sweepQueue.clear();
+    }
+}
+
+int QtAvahiServiceBrowser::maxEntriesPerType() const
+{
+    return m_maxEntriesPerType;
+}
+
+void QtAvahiServiceBrowser::setMaxEntriesPerType(int maxEntriesPerType)
+{
+    m_maxEntriesPerType = maxEntriesPerType;
+}
+
+void QtAvahiServiceBrowser::subscribe(const QString &serviceType, ZeroConfServiceBrowserAvahi *subscriber, BrowseProfile browseProfile)
+{
+    // Browsing all service types on the network is only done while someone asks for all of them
+    if (serviceType.isEmpty()) {
+        BrowseProfile previousProfile = this->browseProfile(QString());
+        m_browseProfiles.insert(subscriber, browseProfile);
+        m_wildcardSubscriptions.append(subscriber);
+        if (m_wildcardSubscriptions.count() == 1) {
+            registerServiceTypeBrowser();
+        } else if ((browseProfile & ~previousProfile) != 0) {
+            foreach (const QString &entryType, m_entries.serviceTypes()) {
+                if (!m_subscriptions.contains(entryType)) {
+                    upgradeEntries(entryType);
+                }
+            }
+        }
+        return;
+    }
+
+    BrowseProfile previousProfile = this->browseProfile(serviceType);
+    m_browseProfiles.insert(subscriber, browseProfile);
+    QList<ZeroConfServiceBrowserAvahi*> &typeSubscribers = m_subscriptions[serviceType];
+    typeSubscribers.append(subscriber);
+    if ((browseProfile & ~previousProfile) != 0) {
+        // Known entries were resolved for less demanding subscribers
+        upgradeEntries(serviceType);
+    }
+    if (m_initialScanFinished.contains(serviceType)) {
+        // Queued so it arrives after the subscriber had a chance to connect to it
+        QMetaObject::invokeMethod(subscriber, [subscriber, serviceType](){
+            subscriber->handleInitialScanFinished(serviceType);
+        }, Qt::QueuedConnection);
+    }
+
+    if (typeSubscribers.count() == 1) {
+        qCDebug(dcPlatformZeroConf()) << "Start browsing for service type" << serviceType;
+    }
+    updateServiceBrowsers(serviceType);
+}
+
+void QtAvahiServiceBrowser::unsubscribe(const QString &serviceType, ZeroConfServiceBrowserAvahi *subscriber)
+{
+    m_browseProfiles.remove(subscriber);
+
+    if (serviceType.isEmpty()) {
+        if (m_wildcardSubscriptions.removeOne(subscriber) && m_wildcardSubscriptions.isEmpty()) {
+            unregisterServiceTypeBrowser();
+        }
+        return;
+    }
+
+    if (!m_subscriptions.contains(serviceType)) {
+        return;
+    }
+
+    QList<ZeroConfServiceBrowserAvahi*> &typeSubscribers = m_subscriptions[serviceType];
+    typeSubscribers.removeOne(subscriber);
+    if (typeSubscribers.isEmpty()) {
+        m_subscriptions.remove(serviceType);
+        freePersistentResolvers(serviceType);
+        qCDebug(dcPlatformZeroConf()) << "Stop browsing for service type" << serviceType;
+    }
+
+    // Drops the browser for the scope of this subscriber, falls back to the ones of the type browser if still browsing everything
+    updateServiceBrowsers(serviceType);
+    if (m_subscriptions.contains(serviceType) || m_serviceTypeBrowser) {
+        return;
+    }
+
+    m_initialScanPending.remove(serviceType);
+    m_initialScanFinished.remove(serviceType);
+    removeEntries(serviceType);
+}
+
+void QtAvahiServiceBrowser::onClientStateChanged(AvahiClientState state)
+{
+    Q_UNUSED(state)
+
+    bool connected = m_client->isConnected();
+    if (connected == m_clientConnected) {
+        return;
+    }
+    m_clientConnected = connected;
+    if (!m_clientConnected) {
+        return;
+    }
+
+    // (Re)connected, start browsing for everything we've been asked for again
+    if (!m_wildcardSubscriptions.isEmpty()) {
+        registerServiceTypeBrowser();
+    }
+    foreach (const QString &serviceType, m_subscriptions.keys()) {
+        updateServiceBrowsers(serviceType);
+    }
+}
+
+void QtAvahiServiceBrowser::onClientAboutToReset()
+{
+    qCDebug(dcPlatformZeroConf()) << "Avahi client reset. Keeping" << m_entries.count() << "entries until they are confirmed again.";
+    freeAvahiObjects();
+    m_clientConnected = false;
+
+    m_discoveredTypes.clear();
+    m_resolveQueue.clear();
+    m_wildcardResolveQueue.clear();
+    m_queuedResolves.clear();
+    m_resolveRetries.clear();
+    m_discoveryTimes.clear();
+    m_sweepQueue.clear();
+    m_initialScanPending.clear();
+    m_outstandingResolves.clear();
+    updateResolveBacklog();
+    // Entries pending removal are stale as well now
+    m_pendingRemovals.clear();
+    // Browsers report the interfaces again
+    m_entries.clearInterfaces();
+    m_resolvedInterfaces.clear();
+    m_addressFallbacks.clear();
+
+    // Evicted when the new browsers report all-for-now without having seen them
+    foreach (const QString &serviceType, m_entries.serviceTypes()) {
+        foreach (const QtAvahiServiceEntryStore::Key &key, m_entries.keys(serviceType)) {
+            m_staleEntries.insert(key);
+        }
+    }
+}
+
+void QtAvahiServiceBrowser::freeAvahiObjects()
+{
+    foreach (AvahiServiceResolver *resolver, m_resolvers.keys()) {
         avahi_service_resolver_free(resolver);
     }
-    m_resolvers.clear();
+    m_resolvers.clear();
+    m_resolversByKey.clear();
+    m_persistentResolvers.clear();
+
+    foreach (AvahiHostNameResolver *resolver, m_hostResolvers.keys()) {
+        avahi_host_name_resolver_free(resolver);
+    }
+    m_hostResolvers.clear();
+    m_hosts.clear();
+    m_serviceHosts.clear();
+
+    while (!m_serviceBrowsers.isEmpty()) {
+        AvahiServiceBrowser *browser = m_serviceBrowsers.keys().first();
+        m_serviceBrowsers.take(browser);
+        avahi_service_browser_free(browser);
+    }
+    m_browserServiceCounts.clear();
+
+    if (m_serviceTypeBrowser) {
+        avahi_service_type_browser_free(m_serviceTypeBrowser);
+        m_serviceTypeBrowser = nullptr;
+    }
+}
+
+void QtAvahiServiceBrowser::evictStaleEntries(const QString &serviceType, AvahiProtocol protocol)
+{
+    foreach (const QtAvahiServiceEntryStore::Key &key, m_staleEntries.values()) {
+        if (key.type != serviceType || (protocol != AVAHI_PROTO_UNSPEC && key.protocol != protocol)) {
+            continue;
+        }
+
+        m_staleEntries.remove(key);
+        if (m_entries.contains(key)) {
+            ZeroConfServiceEntry entry = takeEntry(key);
+            qCDebug(dcPlatformZeroConf()) << "Service disappeared while reconnecting:" << entry;
+            dispatchServiceRemoved(entry);
+        }
+    }
+}
+
+void QtAvahiServiceBrowser::registerServiceTypeBrowser()
+{
+    if (m_serviceTypeBrowser || !m_client->isConnected()) {
+        return;
+    }
+
+    qCDebug(dcPlatformZeroConf()) << "Start browsing for all service types";
+    m_serviceTypeBrowser = avahi_service_type_browser_new(m_client->m_client, AVAHI_IF_UNSPEC, m_protocol, 0, (AvahiLookupFlags) 0, QtAvahiServiceBrowser::serviceTypeBrowserCallback, this);
+    if (!m_serviceTypeBrowser) {
+        qCWarning(dcPlatformZeroConf()) << "Failed to create service type browser:" << avahi_strerror(avahi_client_errno(m_client->m_client));
+    }
+}
+
+void QtAvahiServiceBrowser::unregisterServiceTypeBrowser()
+{
+    if (!m_serviceTypeBrowser) {
+        return;
+    }
+
+    qCDebug(dcPlatformZeroConf()) << "Stop browsing for all service types";
+    avahi_service_type_browser_free(m_serviceTypeBrowser);
+    m_serviceTypeBrowser = nullptr;
+
+    foreach (const BrowserInfo &info, m_discoveredTypes) {
+        if (!m_subscriptions.contains(info.type)) {
+            unregisterServiceBrowser(info.type, info.domain, info.interface, info.protocol);
+        }
+    }
+    m_discoveredTypes.clear();
+    // Types only browsed for some subtype or domain don't need the browsers for the whole type any more
+    foreach (const QString &type, m_subscriptions.keys()) {
+        updateServiceBrowsers(type);
+    }
+
+    foreach (const QString &type, m_entries.serviceTypes()) {
+        if (!m_subscriptions.contains(type)) {
+            removeEntries(type);
+        }
+    }
+}
+
+void QtAvahiServiceBrowser::registerServiceBrowser(const QString &serviceType, const QString &domain, AvahiIfIndex interface, AvahiProtocol protocol, const QString &subtype)
+{
+    if (!m_client->isConnected()) {
+        return;
+    }
+
+    // Subtypes are browsed as "<subtype>._sub.<type>", only services announced with it are reported
+    const QString browseType = subtype.isEmpty() ? serviceType : subtype + "._sub." + serviceType;
+    const QByteArray domainData = domain.toUtf8();
+    AvahiServiceBrowser* browser = avahi_service_browser_new(m_client->m_client,
+                                                             interface,
+                                                             protocol,
+                                                             browseType.toUtf8().data(),
+                                                             domain.isEmpty() ? nullptr : domainData.constData(),
+                                                             (AvahiLookupFlags) 0,
+                                                             QtAvahiServiceBrowser::serviceBrowserCallback,
+                                                             this);
+    if (!browser) {
+        qCWarning(dcPlatformZeroConf()) << "Failed to create service browser for" << browseType << domain << ":" << avahi_strerror(avahi_client_errno(m_client->m_client));
+        return;
+    }
+
+    BrowserInfo info;
+    info.type = serviceType;
+    info.subtype = subtype;
+    info.domain = domain;
+    info.interface = interface;
+    info.protocol = protocol;
+    m_serviceBrowsers.insert(browser, info);
+}
+
+void QtAvahiServiceBrowser::unregisterServiceBrowser(const QString &serviceType, const QString &domain, AvahiIfIndex interface, AvahiProtocol protocol)
+{
+    foreach (AvahiServiceBrowser *browser, m_serviceBrowsers.keys()) {
+        BrowserInfo info = m_serviceBrowsers.value(browser);
+        if (info.type == serviceType && info.domain == domain && info.interface == interface && info.protocol == protocol) {
+            releaseBrowserServices(info.services);
+            m_serviceBrowsers.remove(browser);
+            avahi_service_browser_free(browser);
+        }
+    }
+}
+
+void QtAvahiServiceBrowser::updateServiceBrowsers(const QString &serviceType)
+{
+    // One browser per subtype and domain subscribers asked for. The ones for what the type
+    // browser reported are only needed while nobody browses the whole type anyways.
+    QList<BrowserInfo> wanted;
+    bool browsingType = false;
+    foreach (ZeroConfServiceBrowserAvahi *subscriber, m_subscriptions.value(serviceType)) {
+        BrowserInfo info;
+        info.type = serviceType;
+        info.subtype = subscriber->subtype();
+        info.domain = subscriber->domain();
+        info.interface = AVAHI_IF_UNSPEC;
+        info.protocol = m_protocol;
+        bool known = false;
+        foreach (const BrowserInfo &other, wanted) {
+            known |= other.isSameBrowser(info);
+        }
+        if (!known) {
+            wanted.append(info);
+        }
+        browsingType |= info.subtype.isEmpty() && info.domain.isEmpty();
+    }
+    if (m_serviceTypeBrowser && !browsingType) {
+        foreach (const BrowserInfo &info, m_discoveredTypes) {
+            if (info.type == serviceType) {
+                wanted.append(info);
+            }
+        }
+    }
+
+    QSet<QtAvahiServiceEntryStore::Key> lostKeys;
+    foreach (AvahiServiceBrowser *browser, m_serviceBrowsers.keys()) {
+        const BrowserInfo info = m_serviceBrowsers.value(browser);
+        if (info.type != serviceType) {
+            continue;
+        }
+        bool keep = false;
+        for (int i = 0; i < wanted.count(); i++) {
+            if (wanted.at(i).isSameBrowser(info)) {
+                wanted.removeAt(i);
+                keep = true;
+                break;
+            }
+        }
+        if (keep) {
+            continue;
+        }
+        m_serviceBrowsers.remove(browser);
+        avahi_service_browser_free(browser);
+        releaseBrowserServices(info.services);
+        foreach (const QtAvahiServiceEntryStore::Key &key, info.services) {
+            QtAvahiServiceEntryStore::Key logicalKey = QtAvahiServiceEntryStore::logicalKey(key);
+            lostKeys.insert(logicalKey);
+            if (!info.subtype.isEmpty()) {
+                removeSubtypeMember(logicalKey, info.subtype);
+            }
+        }
+    }
+
+    foreach (const BrowserInfo &info, wanted) {
+        registerServiceBrowser(info.type, info.domain, info.interface, info.protocol, info.subtype);
+    }
+
+    // Entries only the dropped browsers reported are evicted unless the remaining ones report them too
+    bool allForNow = true;
+    QSet<QtAvahiServiceEntryStore::Key> seenKeys;
+    foreach (const BrowserInfo &info, m_serviceBrowsers) {
+        if (info.type != serviceType) {
+            continue;
+        }
+        allForNow &= info.allForNow;
+        foreach (const QtAvahiServiceEntryStore::Key &key, info.services) {
+            seenKeys.insert(QtAvahiServiceEntryStore::logicalKey(key));
+        }
+    }
+    bool stale = false;
+    foreach (const QtAvahiServiceEntryStore::Key &key, lostKeys) {
+        if (!seenKeys.contains(key) && m_entries.contains(key)) {
+            m_staleEntries.insert(key);
+            stale = true;
+        }
+    }
+    if (stale && allForNow && !seenKeys.isEmpty()) {
+        evictStaleEntries(serviceType, AVAHI_PROTO_UNSPEC);
+    }
+}
+
+bool QtAvahiServiceBrowser::isSeenByOtherBrowser(AvahiServiceBrowser *browser, const QtAvahiServiceEntryStore::Key &key) const
+{
+    for (QHash<AvahiServiceBrowser*, BrowserInfo>::const_iterator it = m_serviceBrowsers.constBegin(); it != m_serviceBrowsers.constEnd(); ++it) {
+        if (it.key() != browser && it.value().services.contains(key)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void QtAvahiServiceBrowser::addBrowserService(AvahiServiceBrowser *browser, const QtAvahiServiceEntryStore::Key &key)
+{
+    QSet<QtAvahiServiceEntryStore::Key> &services = m_serviceBrowsers[browser].services;
+    if (services.contains(key)) {
+        return;
+    }
+    services.insert(key);
+    m_browserServiceCounts[QtAvahiServiceEntryStore::logicalKey(key)]++;
+}
+
+void QtAvahiServiceBrowser::removeBrowserService(AvahiServiceBrowser *browser, const QtAvahiServiceEntryStore::Key &key)
+{
+    if (m_serviceBrowsers[browser].services.remove(key)) {
+        releaseBrowserServices({key});
+    }
+}
+
+void QtAvahiServiceBrowser::releaseBrowserServices(const QSet<QtAvahiServiceEntryStore::Key> &services)
+{
+    foreach (const QtAvahiServiceEntryStore::Key &key, services) {
+        QHash<QtAvahiServiceEntryStore::Key, int>::iterator it = m_browserServiceCounts.find(QtAvahiServiceEntryStore::logicalKey(key));
+        if (it != m_browserServiceCounts.end() && --it.value() <= 0) {
+            m_browserServiceCounts.erase(it);
+        }
+    }
+}
+
+void QtAvahiServiceBrowser::addSubtypeMember(const QtAvahiServiceEntryStore::Key &key, const QString &subtype)
+{
+    if (!m_entries.addSubtype(key, subtype)) {
+        return;
+    }
+
+    // Entries not resolved yet are dispatched to the subtype subscribers along with everybody else
+    if (!m_entries.contains(key)) {
+        return;
+    }
+    ZeroConfServiceEntry entry = m_entries.value(key);
+    foreach (ZeroConfServiceBrowserAvahi *subscriber, m_subscriptions.value(key.type)) {
+        if (subscriber->subtype() == subtype && isSubscribed(key.type, subscriber) && matchesScope(subscriber, entry)) {
+            subscriber->handleServiceAdded(entry);
+        }
+    }
+}
+
+void QtAvahiServiceBrowser::removeSubtypeMember(const QtAvahiServiceEntryStore::Key &key, const QString &subtype)
+{
+    // Might still be reported for the subtype on another interface or domain
+    foreach (const BrowserInfo &info, m_serviceBrowsers) {
+        if (info.type != key.type || info.subtype != subtype) {
+            continue;
+        }
+        foreach (const QtAvahiServiceEntryStore::Key &other, info.services) {
+            if (QtAvahiServiceEntryStore::logicalKey(other) == key) {
+                return;
+            }
+        }
+    }
+
+    if (!m_entries.removeSubtype(key, subtype)) {
+        return;
+    }
+
+    if (!m_entries.contains(key)) {
+        return;
+    }
+    ZeroConfServiceEntry entry = m_entries.value(key);
+    foreach (ZeroConfServiceBrowserAvahi *subscriber, m_subscriptions.value(key.type)) {
+        if (subscriber->subtype() == subtype && isSubscribed(key.type, subscriber)
+                && (subscriber->domain().isEmpty() || subscriber->domain() == entry.domain())) {
+            subscriber->handleServiceRemoved(entry);
+        }
+    }
+}
+
+bool QtAvahiServiceBrowser::matchesScope(ZeroConfServiceBrowserAvahi *subscriber, const ZeroConfServiceEntry &entry) const
+{
+    if (!subscriber->domain().isEmpty() && subscriber->domain() != entry.domain()) {
+        return false;
+    }
+    return subscriber->subtype().isEmpty() || isSubtypeMember(subscriber->subtype(), entry);
+}
+
+void QtAvahiServiceBrowser::enqueueServiceResolver(const QtAvahiServiceEntryStore::Key &key)
+{
+    if (m_queuedResolves.contains(key) || browseProfile(key.type) == BrowseProfilePresence) {
+        return;
+    }
+
+    m_queuedResolves.insert(key);
+    countOutstandingResolve(key.type, 1);
+    if (m_subscriptions.contains(key.type)) {
+        m_resolveQueue.append(key);
+    } else {
+        m_wildcardResolveQueue.append(key);
+    }
+
+    processResolveQueue();
+    updateResolveBacklog();
+}
+
+void QtAvahiServiceBrowser::cancelServiceResolver(const QtAvahiServiceEntryStore::Key &key)
+{
+    m_resolveRetries.remove(key);
+    m_discoveryTimes.remove(key);
+
+    if (m_queuedResolves.remove(key)) {
+        countOutstandingResolve(key.type, -1);
+        updateResolveBacklog();
+    }
+
+    AvahiServiceResolver *resolver = m_resolversByKey.value(key);
+    if (resolver) {
+        freeServiceResolver(resolver);
+        processResolveQueue();
+    }
+
+    checkInitialScan(key.type);
+}
+
+void QtAvahiServiceBrowser::processResolveQueue()
+{
+    int depth = m_queuedResolves.count();
+
+    while (activeResolverCount() < m_maxConcurrentResolvers && !m_queuedResolves.isEmpty()) {
+        QList<QtAvahiServiceEntryStore::Key> &queue = m_resolveQueue.isEmpty() ? m_wildcardResolveQueue : m_resolveQueue;
+        if (queue.isEmpty()) {
+            // Only cancelled keys left
+            foreach (const QtAvahiServiceEntryStore::Key &key, m_queuedResolves) {
+                countOutstandingResolve(key.type, -1);
+            }
+            m_queuedResolves.clear();
+            break;
+        }
+
+        QtAvahiServiceEntryStore::Key key = queue.takeFirst();
+        if (!m_queuedResolves.remove(key)) {
+            continue;
+        }
+        countOutstandingResolve(key.type, -1);
+
+        // The type might not be of interest any more since the service has been queued
+        if (!isBrowsed(key.type)) {
+            m_discoveryTimes.remove(key);
+            continue;
+        }
+
+        if (!registerServiceResolver(key)) {
+            if (m_client->isConnected()) {
+                // E.g. the daemon ran out of objects for this client, back off like after a failed resolve
+                scheduleResolveRetry(key);
+            } else {
+                // The service browsers report the service again once reconnected
+                m_resolveRetries.remove(key);
+                m_discoveryTimes.remove(key);
+            }
+            checkInitialScan(key.type);
+        }
+    }
+
+    if (depth != m_queuedResolves.count()) {
+        qCDebug(dcPlatformZeroConf()) << "Resolve queue depth:" << m_queuedResolves.count() << "Active resolvers:" << activeResolverCount();
+        updateResolveBacklog();
+    }
+}
+
+void QtAvahiServiceBrowser::updateResolveBacklog()
+{
+    bool resolveBacklog = m_resolveBacklogThreshold > 0 && m_queuedResolves.count() > m_resolveBacklogThreshold;
+    if (resolveBacklog == m_resolveBacklog) {
+        return;
+    }
+    m_resolveBacklog = resolveBacklog;
+    emit resolveBacklogChanged(m_resolveBacklog);
+}
+
+bool QtAvahiServiceBrowser::registerServiceResolver(const QtAvahiServiceEntryStore::Key &key)
+{
+    if (!m_client->isConnected()) {
+        return false;
+    }
+
+    // Only look up what the subscribers of the type need
+    BrowseProfile profile = browseProfile(key.type);
+    int flags = 0;
+    if (!profile.testFlag(BrowseProfileTxt)) {
+        flags |= AVAHI_LOOKUP_NO_TXT;
+    }
+    if (!profile.testFlag(BrowseProfileAddress)
+            || (m_hostAddressCacheEnabled && !m_addressFallbacks.contains(QtAvahiServiceEntryStore::logicalKey(key)))) {
+        flags |= AVAHI_LOOKUP_NO_ADDRESS;
+    }
+
+    AvahiServiceResolver *resolver = avahi_service_resolver_new(m_client->m_client,
+                                                                key.interface,
+                                                                key.protocol,
+                                                                key.name.toUtf8().data(),
+                                                                key.type.toUtf8().data(),
+                                                                key.domain.toUtf8().data(),
+                                                                m_protocol,
+                                                                (AvahiLookupFlags) flags,
+                                                                QtAvahiServiceBrowser::serviceResolverCallback,
+                                                                this);
+    if (!resolver) {
+        qCWarning(dcPlatformZeroConf()) << "Failed to resolve service" << key.type << key.name << ":" << avahi_strerror(avahi_client_errno(m_client->m_client));
+        return false;
+    }
+
+    // Superseded by the new one, e.g. when retried while a persistent resolver was still around
+    if (m_resolversByKey.contains(key)) {
+        freeServiceResolver(m_resolversByKey.value(key));
+    }
+    m_resolvers.insert(resolver, key);
+    m_resolversByKey.insert(key, resolver);
+    countOutstandingResolve(key.type, 1);
+    QtAvahiStatistics::instance()->increment(QtAvahiStatistics::CounterResolves, key.type);
+    return true;
+}
+
+void QtAvahiServiceBrowser::freeServiceResolver(AvahiServiceResolver *resolver)
+{
+    QtAvahiServiceEntryStore::Key key = m_resolvers.take(resolver);
+    m_resolversByKey.remove(key);
+    // Persistent resolvers are done with their initial resolve already
+    if (!m_persistentResolvers.remove(resolver)) {
+        countOutstandingResolve(key.type, -1);
+    }
+    avahi_service_resolver_free(resolver);
+}
+
+void QtAvahiServiceBrowser::countOutstandingResolve(const QString &serviceType, int delta)
+{
+    QHash<QString, int>::iterator it = m_outstandingResolves.find(serviceType);
+    if (it == m_outstandingResolves.end()) {
+        m_outstandingResolves.insert(serviceType, delta);
+        return;
+    }
+    it.value() += delta;
+    if (it.value() == 0) {
+        m_outstandingResolves.erase(it);
+    }
+}
+
+void QtAvahiServiceBrowser::scheduleResolveRetry(const QtAvahiServiceEntryStore::Key &key)
+{
+    ResolveRetry &retry = m_resolveRetries[key];
+    retry.attempt++;
+    if (retry.attempt > m_maxResolveRetries) {
+        qCDebug(dcPlatformZeroConf()) << "Giving up resolving" << key.type << key.name << "after" << m_maxResolveRetries << "retries";
+        m_resolveRetries.remove(key);
+        m_discoveryTimes.remove(key);
+        m_addressFallbacks.remove(QtAvahiServiceEntryStore::logicalKey(key));
+        return;
+    }
+    QtAvahiStatistics::instance()->increment(QtAvahiStatistics::CounterResolveRetries, key.type);
 
-    while (!m_serviceBrowsers.isEmpty()) {
-        AvahiServiceBrowser *browser = m_serviceBrowsers.keys().first();
-        m_serviceBrowsers.take(browser);
-        avahi_service_browser_free(browser);
+    // Exponential backoff with +/- 25% jitter so retries for many stale services don't line up
+    qint64 interval = qMin(static_cast<qint64>(m_resolveRetryInterval) << qMin(retry.attempt - 1, 16), static_cast<qint64>(m_maxResolveRetryInterval));
+    interval += QRandomGenerator::global()->bounded(static_cast<int>(interval / 2 + 1)) - interval / 4;
+    retry.dueTime = QDateTime::currentMSecsSinceEpoch() + interval;
+
+    qCDebug(dcPlatformZeroConf()) << "Retrying to resolve" << key.type << key.name << "in" << interval << "ms (attempt" << retry.attempt << "of" << m_maxResolveRetries << ")";
+    int attempt = retry.attempt;
+    QTimer::singleShot(static_cast<int>(interval), this, [this, key, attempt](){
+        // Cancelled or superseded in the meantime
+        if (m_resolveRetries.value(key).attempt != attempt) {
+            return;
+        }
+        if (!isBrowsed(key.type) || !m_entries.interfaces(key).contains(key.interface)) {
+            m_resolveRetries.remove(key);
+            m_discoveryTimes.remove(key);
+            return;
+        }
+        enqueueServiceResolver(key);
+    });
+}
+
+void QtAvahiServiceBrowser::schedulePendingRemoval(const QtAvahiServiceEntryStore::Key &key)
+{
+    qint64 dueTime = QDateTime::currentMSecsSinceEpoch() + m_removalGracePeriod;
+    m_pendingRemovals.insert(key, dueTime);
+    qCDebug(dcPlatformZeroConf()) << "Service" << key.type << key.name << "removed. Holding it back for" << m_removalGracePeriod << "ms";
+
+    QTimer::singleShot(m_removalGracePeriod, this, [this, key, dueTime](){
+        // Came back or removed otherwise in the meantime
+        if (!m_pendingRemovals.contains(key) || m_pendingRemovals.value(key) != dueTime) {
+            return;
+        }
+        m_pendingRemovals.remove(key);
+        m_expiredRemovalCount++;
+        if (m_entries.contains(key)) {
+            ZeroConfServiceEntry entry = takeEntry(key);
+            qCDebug(dcPlatformZeroConf()) << "Service removed:" << entry;
+            dispatchServiceRemoved(entry);
+        }
+    });
+}
+
+ZeroConfServiceEntry QtAvahiServiceBrowser::takeEntry(const QtAvahiServiceEntryStore::Key &key)
+{
+    m_resolvedInterfaces.remove(key);
+    m_addressFallbacks.remove(key);
+    releaseHost(key);
+    return m_entries.take(key);
+}
+
+void QtAvahiServiceBrowser::evictEntry(const QtAvahiServiceEntryStore::Key &key)
+{
+    // Persistent resolvers would bring it right back
+    foreach (AvahiIfIndex interface, m_entries.interfaces(key)) {
+        QtAvahiServiceEntryStore::Key interfaceKey = key;
+        interfaceKey.interface = interface;
+        cancelServiceResolver(interfaceKey);
     }
+    m_staleEntries.remove(key);
+    m_pendingRemovals.remove(key);
 
-    if (m_serviceTypeBrowser) {
-        avahi_service_type_browser_free(m_serviceTypeBrowser);
+    ZeroConfServiceEntry entry = takeEntry(key);
+    QtAvahiStatistics::instance()->increment(QtAvahiStatistics::CounterEvictions, key.type);
+    qCDebug(dcPlatformZeroConf()) << "Service evicted:" << entry;
+    dispatchServiceRemoved(entry);
+}
+
+void QtAvahiServiceBrowser::sweepEntries()
+{
+    if (m_sweepQueue.isEmpty()) {
+        foreach (const QString &serviceType, m_entries.serviceTypes()) {
+            m_sweepQueue.append(m_entries.keys(serviceType));
+        }
+    }
+    if (m_sweepQueue.isEmpty()) {
+        return;
+    }
+
+    // Entries still reported by a browser are confirmed, everything else ages
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    for (int i = 0; i < 256 && !m_sweepQueue.isEmpty(); i++) {
+        QtAvahiServiceEntryStore::Key key = m_sweepQueue.takeFirst();
+        // Entries pending removal are taken care of by the grace period
+        if (!m_entries.contains(key) || m_pendingRemovals.contains(key)) {
+            continue;
+        }
+        if (m_browserServiceCounts.contains(key)) {
+            m_entries.touch(key, now);
+            continue;
+        }
+        if (now - m_entries.lastSeen(key) < m_entryMaxAge) {
+            continue;
+        }
+        qCDebug(dcPlatformZeroConf()) << "Service" << key.type << key.name << "not reported by any browser for" << (now - m_entries.lastSeen(key)) << "ms";
+        evictEntry(key);
     }
 }
 
-QList<ZeroConfServiceEntry> QtAvahiServiceBrowser::entries()
+void QtAvahiServiceBrowser::resolveHostAddress(const QtAvahiServiceEntryStore::Key &key, AvahiIfIndex interface, const ZeroConfServiceEntry &entry, AvahiLookupResultFlags flags)
 {
-    return m_entries;
+    HostKey hostKey(entry.hostName(), key.protocol);
+    if (m_serviceHosts.contains(key) && m_serviceHosts.value(key) != hostKey) {
+        // The service moved to another host
+        releaseHost(key);
+    }
+
+    expireHosts();
+
+    HostInfo &host = m_hosts[hostKey];
+    HostInfo::Service service;
+    service.entry = entry;
+    service.flags = flags;
+    host.services.insert(key, service);
+    if (!m_serviceHosts.contains(key) && !m_entries.contains(key)) {
+        countOutstandingResolve(key.type, 1);
+    }
+    m_serviceHosts.insert(key, hostKey);
+
+    if (!host.resolver) {
+        host.resolver = avahi_host_name_resolver_new(m_client->m_client,
+                                                     interface,
+                                                     key.protocol,
+                                                     entry.hostName().toUtf8().data(),
+                                                     m_protocol,
+                                                     (AvahiLookupFlags) 0,
+                                                     QtAvahiServiceBrowser::hostNameResolverCallback,
+                                                     this);
+        if (!host.resolver) {
+            qCWarning(dcPlatformZeroConf()) << "Failed to resolve host" << entry.hostName() << ":" << avahi_strerror(avahi_client_errno(m_client->m_client));
+        } else {
+            m_hostResolvers.insert(host.resolver, hostKey);
+        }
+    }
+
+    if (!host.address.isNull()) {
+        qCDebug(dcPlatformZeroConf()) << "Completing" << key.type << key.name << "with cached address of" << entry.hostName() << host.address;
+        updateEntry(key, createEntry(entry, host.address, flags));
+    }
 }
 
-void QtAvahiServiceBrowser::registerServiceBrowser(const QString &serviceType, const QString &domain, AvahiIfIndex interface, AvahiProtocol protocol)
+void QtAvahiServiceBrowser::releaseHost(const QtAvahiServiceEntryStore::Key &key)
 {
-    AvahiServiceBrowser* browser = avahi_service_browser_new(m_client->m_client,
-                                                             interface,
-                                                             protocol,
-                                                             serviceType.toUtf8().data(),
-                                                             domain.toUtf8().data(),
-                                                             (AvahiLookupFlags) 0,
-                                                             QtAvahiServiceBrowser::serviceBrowserCallback,
-                                                             this);
-    if (!browser) {
-        qCWarning(dcPlatformZeroConf()) << "Failed to create service browser for" << serviceType << domain << ":" << avahi_strerror(avahi_client_errno(m_client->m_client));
+    if (!m_serviceHosts.contains(key)) {
         return;
     }
 
-    BrowserInfo info;
-    info.type = serviceType;
-    info.domain = domain;
-    info.interface = interface;
-    info.protocol = protocol;
-    m_serviceBrowsers.insert(browser, info);
+    HostKey hostKey = m_serviceHosts.take(key);
+    if (!m_entries.contains(key)) {
+        countOutstandingResolve(key.type, -1);
+    }
+    QHash<HostKey, HostInfo>::iterator it = m_hosts.find(hostKey);
+    if (it == m_hosts.end()) {
+        return;
+    }
+    it.value().services.remove(key);
+    if (!it.value().services.isEmpty()) {
+        return;
+    }
+
+    // Nothing depends on the host any more, keep its address around for a while
+    if (it.value().resolver) {
+        m_hostResolvers.remove(it.value().resolver);
+        avahi_host_name_resolver_free(it.value().resolver);
+        it.value().resolver = nullptr;
+    }
+    if (it.value().address.isNull()) {
+        m_hosts.erase(it);
+        return;
+    }
+    it.value().expiry = QDateTime::currentMSecsSinceEpoch() + m_hostAddressLifetime;
 }
 
-void QtAvahiServiceBrowser::unregisterServiceBrowser(const QString &serviceType, const QString &domain, AvahiIfIndex interface, AvahiProtocol protocol)
+void QtAvahiServiceBrowser::expireHosts()
 {
-    foreach (AvahiServiceBrowser *browser, m_serviceBrowsers.keys()) {
-        BrowserInfo info = m_serviceBrowsers.value(browser);
-        if (info.type == serviceType && info.domain == domain && info.interface == interface && info.protocol == protocol) {
-            m_serviceBrowsers.remove(browser);
-            avahi_service_browser_free(browser);
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    for (QHash<HostKey, HostInfo>::iterator it = m_hosts.begin(); it != m_hosts.end(); ) {
+        if (!it.value().resolver && it.value().services.isEmpty() && it.value().expiry <= now) {
+            it = m_hosts.erase(it);
+        } else {
+            ++it;
         }
     }
 }
 
-void QtAvahiServiceBrowser::registerServiceResolver(const QString &name, const QString &type, const QString &domain, AvahiIfIndex interface, AvahiProtocol protocol)
+QtAvahiServiceBrowser::BrowseProfile QtAvahiServiceBrowser::browseProfile(const QString &serviceType) const
 {
-    AvahiServiceResolver *resolver = avahi_service_resolver_new(m_client->m_client,
-                                                                interface,
-                                                                protocol,
-                                                                name.toUtf8().data(),
-                                                                type.toUtf8().data(),
-                                                                domain.toUtf8().data(),
-                                                                AVAHI_PROTO_UNSPEC,
-                                                                (AvahiLookupFlags) 0,
-                                                                QtAvahiServiceBrowser::serviceResolverCallback,
-                                                                this);
-    if (!resolver) {
-        qCWarning(dcPlatformZeroConf()) << "Failed to resolve service" << type << name << ":" << avahi_strerror(avahi_client_errno(m_client->m_client));
+    BrowseProfile profile = BrowseProfilePresence;
+    foreach (ZeroConfServiceBrowserAvahi *subscriber, subscribers(serviceType)) {
+        profile |= m_browseProfiles.value(subscriber, BrowseProfileFull);
+    }
+    return profile;
+}
+
+void QtAvahiServiceBrowser::upgradeEntries(const QString &serviceType)
+{
+    qCDebug(dcPlatformZeroConf()) << "Resolving" << m_entries.count(serviceType) << "known services of type" << serviceType << "again for" << browseProfile(serviceType);
+    foreach (const QtAvahiServiceEntryStore::Key &key, m_entries.keys(serviceType)) {
+        QList<AvahiIfIndex> interfaces = m_entries.interfaces(key);
+        if (interfaces.isEmpty()) {
+            continue;
+        }
+        QtAvahiServiceEntryStore::Key resolveKey = key;
+        resolveKey.interface = m_resolvedInterfaces.value(key, interfaces.first());
+        // Running resolvers have been started with the previous lookup flags
+        cancelServiceResolver(resolveKey);
+        enqueueServiceResolver(resolveKey);
+    }
+}
+
+bool QtAvahiServiceBrowser::isInterfaceBrowsed(AvahiIfIndex interface) const
+{
+    if (m_allowedInterfaces.isEmpty() && m_ignoredInterfaces.isEmpty()) {
+        return true;
+    }
+
+    QString interfaceName = QNetworkInterface::interfaceNameFromIndex(interface);
+    if (!m_allowedInterfaces.isEmpty() && !matchesInterface(m_allowedInterfaces, interfaceName)) {
+        return false;
+    }
+    return !matchesInterface(m_ignoredInterfaces, interfaceName);
+}
+
+bool QtAvahiServiceBrowser::matchesInterface(const QStringList &patterns, const QString &interfaceName)
+{
+    // Patterns are interface names, a trailing '*' matches all interfaces starting with it (e.g. "docker*")
+    foreach (const QString &pattern, patterns) {
+        if (pattern.endsWith('*') ? interfaceName.startsWith(pattern.left(pattern.length() - 1)) : interfaceName == pattern) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool QtAvahiServiceBrowser::isBrowsed(const QString &serviceType) const
+{
+    return m_serviceTypeBrowser || m_subscriptions.contains(serviceType);
+}
+
+void QtAvahiServiceBrowser::removeEntries(const QString &serviceType)
+{
+    if (!m_staleEntries.isEmpty() || !m_pendingRemovals.isEmpty()) {
+        foreach (const QtAvahiServiceEntryStore::Key &key, m_entries.keys(serviceType)) {
+            m_staleEntries.remove(key);
+            m_pendingRemovals.remove(key);
+        }
+    }
+    foreach (const QtAvahiServiceEntryStore::Key &key, m_entries.keys(serviceType)) {
+        m_resolvedInterfaces.remove(key);
+        m_addressFallbacks.remove(key);
+    }
+    foreach (const QtAvahiServiceEntryStore::Key &key, m_serviceHosts.keys()) {
+        if (key.type == serviceType) {
+            releaseHost(key);
+        }
+    }
+
+    foreach (const ZeroConfServiceEntry &entry, m_entries.takeAll(serviceType)) {
+        qCDebug(dcPlatformZeroConf()) << "Service removed:" << entry;
+        dispatchServiceRemoved(entry);
+    }
+}
+
+void QtAvahiServiceBrowser::checkInitialScan(const QString &serviceType)
+{
+    if (!m_initialScanPending.contains(serviceType)) {
+        return;
+    }
+
+    // Entries only count as discovered once resolved, wait for the ones still in flight
+    if (m_outstandingResolves.contains(serviceType)) {
         return;
     }
 
-    m_resolvers.insert(resolver);
+    m_initialScanPending.remove(serviceType);
+    m_initialScanFinished.insert(serviceType);
+    qCDebug(dcPlatformZeroConf()) << "Initial scan finished for service type" << serviceType << "with" << m_entries.count(serviceType) << "entries";
+    dispatchInitialScanFinished(serviceType);
+}
+
+void QtAvahiServiceBrowser::dispatchServiceAdded(const ZeroConfServiceEntry &entry)
+{
+    emit serviceAdded(entry);
+
+    // Subscribers may be deleted by whoever handles their signals, make sure they are still around
+    foreach (ZeroConfServiceBrowserAvahi *subscriber, subscribers(entry.serviceType())) {
+        if (isSubscribed(entry.serviceType(), subscriber) && matchesScope(subscriber, entry)) {
+            subscriber->handleServiceAdded(entry);
+        }
+    }
+}
+
+void QtAvahiServiceBrowser::dispatchServiceUpdated(const ZeroConfServiceEntry &oldEntry, const ZeroConfServiceEntry &newEntry)
+{
+    emit serviceUpdated(oldEntry, newEntry);
+
+    foreach (ZeroConfServiceBrowserAvahi *subscriber, subscribers(newEntry.serviceType())) {
+        if (isSubscribed(newEntry.serviceType(), subscriber) && matchesScope(subscriber, newEntry)) {
+            subscriber->handleServiceUpdated(oldEntry, newEntry);
+        }
+    }
+}
+
+void QtAvahiServiceBrowser::dispatchServiceRemoved(const ZeroConfServiceEntry &entry)
+{
+    emit serviceRemoved(entry);
+
+    foreach (ZeroConfServiceBrowserAvahi *subscriber, subscribers(entry.serviceType())) {
+        if (isSubscribed(entry.serviceType(), subscriber) && matchesScope(subscriber, entry)) {
+            subscriber->handleServiceRemoved(entry);
+        }
+    }
+
+    // Subtype membership is only needed until the removal has been dispatched
+    QtAvahiServiceEntryStore::Key key = QtAvahiServiceEntryStore::entryKey(entry);
+    if (!m_entries.contains(key)) {
+        m_entries.removeSubtypes(key);
+    }
+}
+
+void QtAvahiServiceBrowser::dispatchInitialScanFinished(const QString &serviceType)
+{
+    foreach (ZeroConfServiceBrowserAvahi *subscriber, subscribers(serviceType)) {
+        if (isSubscribed(serviceType, subscriber)) {
+            subscriber->handleInitialScanFinished(serviceType);
+        }
+    }
+}
+
+QList<ZeroConfServiceBrowserAvahi *> QtAvahiServiceBrowser::subscribers(const QString &serviceType) const
+{
+    QHash<QString, QList<ZeroConfServiceBrowserAvahi*>>::const_iterator it = m_subscriptions.constFind(serviceType);
+    if (it == m_subscriptions.constEnd()) {
+        return m_wildcardSubscriptions;
+    }
+    return it.value() + m_wildcardSubscriptions;
+}
+
+bool QtAvahiServiceBrowser::isSubscribed(const QString &serviceType, ZeroConfServiceBrowserAvahi *subscriber) const
+{
+    return m_wildcardSubscriptions.contains(subscriber) || m_subscriptions.value(serviceType).contains(subscriber);
 }
 
 
@@ -137,17 +1357,65 @@ void QtAvahiServiceBrowser::serviceTypeBrowserCallback(AvahiServiceTypeBrowser *
 
     switch (event) {
     case AVAHI_BROWSER_NEW:
+    {
+        if (!instance->isInterfaceBrowsed(interface)) {
+            break;
+        }
         qCDebug(dcPlatformZeroConf()) << "New service type:" << type;
-        instance->registerServiceBrowser(type, domain, interface, protocol);
+        BrowserInfo info;
+        info.type = instance->m_entries.intern(type);
+        info.domain = instance->m_entries.intern(domain);
+        info.interface = interface;
+        info.protocol = protocol;
+        instance->m_discoveredTypes.append(info);
+        // Types with a dedicated browser are already taken care of, unless only browsed for some subtype or domain
+        if (!instance->m_subscriptions.contains(info.type)) {
+            instance->registerServiceBrowser(info.type, info.domain, interface, protocol);
+        } else {
+            instance->updateServiceBrowsers(info.type);
+        }
         break;
+    }
     case AVAHI_BROWSER_REMOVE:
+    {
         qCDebug(dcPlatformZeroConf()) << "Service type removed:" << type;
-        instance->unregisterServiceBrowser(type, domain, interface, protocol);
+        QString typeString(type);
+        QString domainString(domain);
+        for (int i = instance->m_discoveredTypes.count() - 1; i >= 0; i--) {
+            const BrowserInfo &info = instance->m_discoveredTypes.at(i);
+            if (info.type == typeString && info.domain == domainString && info.interface == interface && info.protocol == protocol) {
+                instance->m_discoveredTypes.removeAt(i);
+            }
+        }
+        if (!instance->m_subscriptions.contains(typeString)) {
+            instance->unregisterServiceBrowser(typeString, domainString, interface, protocol);
+        } else {
+            instance->updateServiceBrowsers(typeString);
+        }
         break;
+    }
     case AVAHI_BROWSER_CACHE_EXHAUSTED:
         break;
-    case AVAHI_BROWSER_ALL_FOR_NOW:
+    case AVAHI_BROWSER_ALL_FOR_NOW: {
+        // Stale entries of types which are not around any more won't be reported by any service browser
+        if (instance->m_staleEntries.isEmpty()) {
+            break;
+        }
+        QSet<QString> browsedTypes;
+        foreach (const BrowserInfo &info, instance->m_serviceBrowsers) {
+            browsedTypes.insert(info.type);
+        }
+        QSet<QString> staleTypes;
+        foreach (const QtAvahiServiceEntryStore::Key &key, instance->m_staleEntries) {
+            if (!browsedTypes.contains(key.type)) {
+                staleTypes.insert(key.type);
+            }
+        }
+        foreach (const QString &staleType, staleTypes) {
+            instance->evictStaleEntries(staleType, AVAHI_PROTO_UNSPEC);
+        }
         break;
+    }
     case AVAHI_BROWSER_FAILURE:
         qCWarning(dcPlatformZeroConf()) << "Service type browser error:" << QString(avahi_strerror(avahi_client_errno(instance->m_client->m_client)));
         break;
@@ -157,33 +1425,136 @@ void QtAvahiServiceBrowser::serviceTypeBrowserCallback(AvahiServiceTypeBrowser *
 
 void QtAvahiServiceBrowser::serviceBrowserCallback(AvahiServiceBrowser *browser, AvahiIfIndex interface, AvahiProtocol protocol, AvahiBrowserEvent event, const char *name, const char *type, const char *domain, AvahiLookupResultFlags flags, void *userdata)
 {
-    Q_UNUSED(browser)
-    Q_UNUSED(flags)
-
     QtAvahiServiceBrowser *instance = static_cast<QtAvahiServiceBrowser*>(userdata);
 
     switch (event) {
     case AVAHI_BROWSER_NEW: {
+        // Services on interfaces we're not interested in are neither resolved nor reported
+        if (!instance->isInterfaceBrowsed(interface)) {
+            break;
+        }
+        if (!instance->m_serviceBrowsers.contains(browser)) {
+            break;
+        }
         // Start resolving new service
         qCDebug(dcPlatformZeroConf()) << "New Service browser" << type << name;
-        instance->registerServiceResolver(name, type, domain, interface, protocol);
+        const BrowserInfo info = instance->m_serviceBrowsers.value(browser);
+        QtAvahiServiceEntryStore::Key key(name, info.subtype.isEmpty() ? instance->m_entries.intern(type) : info.type, instance->m_entries.intern(domain), interface, protocol);
+        QtAvahiServiceEntryStore::Key logicalKey = QtAvahiServiceEntryStore::logicalKey(key);
+        instance->m_staleEntries.remove(logicalKey);
+        instance->m_entries.touch(logicalKey, QDateTime::currentMSecsSinceEpoch());
+        instance->addBrowserService(browser, key);
+        if (!info.subtype.isEmpty()) {
+            instance->addSubtypeMember(logicalKey, info.subtype);
+        }
+        if (instance->isSeenByOtherBrowser(browser, key)) {
+            // Reported for another subtype or by the type browser already
+            break;
+        }
+        bool firstInterface = instance->m_entries.addInterface(key);
+        if (instance->m_pendingRemovals.remove(logicalKey)) {
+            // Back within the grace period, the entry we have is still valid
+            instance->m_absorbedRemovalCount++;
+            qCDebug(dcPlatformZeroConf()) << "Service" << type << name << "came back within the grace period. Absorbed" << instance->m_absorbedRemovalCount << "removals so far.";
+            // Persistent resolvers are cancelled on removal, without one changes wouldn't be reported any more
+            if (!instance->m_persistentResolversEnabled || !instance->m_subscriptions.contains(key.type)) {
+                break;
+            }
+        } else if (!firstInterface) {
+            // Already known from another interface, one resolve per service is enough
+            qCDebug(dcPlatformZeroConf()) << "Service" << type << name << "also announced on interface" << interface;
+            break;
+        }
+        if (instance->browseProfile(key.type) == BrowseProfilePresence) {
+            // Nobody needs more than the fact it's there, no need to resolve it
+            ZeroConfServiceEntry entry(name, key.type, QHostAddress(), key.domain, QString(), 0, convertProtocol(protocol), QStringList(),
+                                       flags & AVAHI_LOOKUP_RESULT_CACHED,
+                                       flags & AVAHI_LOOKUP_RESULT_WIDE_AREA,
+                                       flags & AVAHI_LOOKUP_RESULT_MULTICAST,
+                                       flags & AVAHI_LOOKUP_RESULT_LOCAL,
+                                       flags & AVAHI_LOOKUP_RESULT_OUR_OWN);
+            instance->updateEntry(logicalKey, entry);
+            break;
+        }
+        if (!instance->m_discoveryTimes.contains(key)) {
+            instance->m_discoveryTimes.insert(key, QtAvahiStatistics::timestamp());
+        }
+        instance->enqueueServiceResolver(key);
         break;
     }
     case AVAHI_BROWSER_REMOVE: {
-        QMutableListIterator<ZeroConfServiceEntry> i(instance->m_entries);
-        while (i.hasNext()) {
-            ZeroConfServiceEntry entry = i.next();
-            // FIXME: In theory we'd need to compare interface too, but nymea's zeroconfentry doesn't store that information
-            if (entry.name() == name && entry.serviceType() == type && entry.domain() == domain && entry.protocol() == convertProtocol(protocol)) {
-                i.remove();
-                qCDebug(dcPlatformZeroConf()) << "Service removed:" << entry;
-                emit instance->serviceRemoved(entry);
+        if (!instance->m_serviceBrowsers.contains(browser)) {
+            break;
+        }
+        const BrowserInfo info = instance->m_serviceBrowsers.value(browser);
+        QtAvahiServiceEntryStore::Key key(name, info.subtype.isEmpty() ? instance->m_entries.intern(type) : info.type, instance->m_entries.intern(domain), interface, protocol);
+        QtAvahiServiceEntryStore::Key logicalKey = QtAvahiServiceEntryStore::logicalKey(key);
+        instance->removeBrowserService(browser, key);
+        if (instance->isSeenByOtherBrowser(browser, key)) {
+            // Still reported by another browser, it might just not be announced with the subtype any more
+            if (!info.subtype.isEmpty()) {
+                instance->removeSubtypeMember(logicalKey, info.subtype);
             }
+            break;
+        }
+        instance->m_staleEntries.remove(logicalKey);
+        bool resolving = instance->m_queuedResolves.contains(key) || instance->m_resolversByKey.contains(key);
+        instance->cancelServiceResolver(key);
+        if (instance->m_entries.removeInterface(key) > 0) {
+            if (!info.subtype.isEmpty()) {
+                instance->removeSubtypeMember(logicalKey, info.subtype);
+            }
+            // Still around on other interfaces, only resolve it again if it was resolved on this one
+            if (resolving || instance->m_resolvedInterfaces.value(logicalKey, AVAHI_IF_UNSPEC) == interface) {
+                QtAvahiServiceEntryStore::Key next = key;
+                next.interface = instance->m_entries.interfaces(key).first();
+                instance->enqueueServiceResolver(next);
+            }
+            break;
+        }
+        if (instance->m_removalGracePeriod > 0 && instance->m_entries.contains(logicalKey)) {
+            instance->schedulePendingRemoval(logicalKey);
+            break;
+        }
+        // Might as well be waiting for the address of its host
+        instance->releaseHost(logicalKey);
+        if (instance->m_entries.contains(logicalKey)) {
+            ZeroConfServiceEntry entry = instance->takeEntry(logicalKey);
+            qCDebug(dcPlatformZeroConf()) << "Service removed:" << entry;
+            instance->dispatchServiceRemoved(entry);
+        } else {
+            // Gone before it was resolved
+            instance->m_entries.removeSubtypes(logicalKey);
+            instance->m_addressFallbacks.remove(logicalKey);
         }
         break;
     }
-    case AVAHI_BROWSER_ALL_FOR_NOW:
+    case AVAHI_BROWSER_ALL_FOR_NOW: {
+        if (!instance->m_serviceBrowsers.contains(browser)) {
+            break;
+        }
+        instance->m_serviceBrowsers[browser].allForNow = true;
+        const BrowserInfo info = instance->m_serviceBrowsers.value(browser);
+        if (!instance->m_staleEntries.isEmpty()) {
+            // Entries are shared by the browsers of all interfaces, wait for all of them
+            bool allForNow = true;
+            foreach (const BrowserInfo &other, instance->m_serviceBrowsers) {
+                if (other.type == info.type && !other.allForNow
+                        && (info.protocol == AVAHI_PROTO_UNSPEC || other.protocol == AVAHI_PROTO_UNSPEC || other.protocol == info.protocol)) {
+                    allForNow = false;
+                    break;
+                }
+            }
+            if (allForNow) {
+                instance->evictStaleEntries(info.type, info.protocol);
+            }
+        }
+        if (!instance->m_initialScanFinished.contains(info.type)) {
+            instance->m_initialScanPending.insert(info.type);
+            instance->checkInitialScan(info.type);
+        }
         break;
+    }
     case AVAHI_BROWSER_CACHE_EXHAUSTED:
         break;
     case AVAHI_BROWSER_FAILURE:
@@ -195,57 +1566,248 @@ void QtAvahiServiceBrowser::serviceBrowserCallback(AvahiServiceBrowser *browser,
 
 void QtAvahiServiceBrowser::serviceResolverCallback(AvahiServiceResolver *resolver, AvahiIfIndex interface, AvahiProtocol protocol, AvahiResolverEvent event, const char *name, const char *type, const char *domain, const char *host_name, const AvahiAddress *address, uint16_t port, AvahiStringList *txt, AvahiLookupResultFlags flags, void *userdata)
 {
-    Q_UNUSED(interface)
-
     QtAvahiServiceBrowser *instance = static_cast<QtAvahiServiceBrowser*>(userdata);
+    QtAvahiServiceEntryStore::Key key(name, instance->m_entries.intern(type), instance->m_entries.intern(domain), interface, protocol);
 
     switch (event) {
     case AVAHI_RESOLVER_FAILURE:
     {
         qCDebug(dcPlatformZeroConf()) << "Failed to resolve" << type << name;
-        // Retrying in 5 seconds... (Copying char* and capturing the copy in the lambda)
-        QString nameCopy(name);
-        QString typeCopy(type);
-        QString domainCopy(domain);
-        QTimer::singleShot(5000, instance, [=]{
-            instance->registerServiceResolver(nameCopy, typeCopy, domainCopy, interface, protocol);
-        });
+        QtAvahiStatistics::instance()->increment(QtAvahiStatistics::CounterResolveFailures, key.type);
+        instance->scheduleResolveRetry(key);
         break;
     }
     case AVAHI_RESOLVER_FOUND: {
         qCDebug(dcPlatformZeroConf()) << "Resolved" << type << name;
+        instance->m_resolveRetries.remove(key);
+        QHash<QtAvahiServiceEntryStore::Key, qint64>::iterator discovery = instance->m_discoveryTimes.find(key);
+        if (discovery != instance->m_discoveryTimes.end()) {
+            QtAvahiStatistics::instance()->addSample(QtAvahiStatistics::HistogramResolveLatency, QtAvahiStatistics::timestamp() - discovery.value());
+            instance->m_discoveryTimes.erase(discovery);
+        }
+        QHostAddress hostAddress;
+        QtAvahiServiceEntryStore::Key logicalKey = QtAvahiServiceEntryStore::logicalKey(key);
+        if (address) {
+            char a[AVAHI_ADDRESS_STR_MAX];
+            avahi_address_snprint(a, sizeof(a), address);
+            hostAddress = QHostAddress(QString(a));
+            // Got the address on its own, the host resolver gets another chance next time
+            instance->m_addressFallbacks.remove(logicalKey);
+        }
+
+        quint64 fingerprint = txtFingerprint(txt);
+
+        // Persistent resolvers report again for changes of any record, only decode what actually changed
+        bool unchanged = false;
+        if (address && instance->m_entries.contains(logicalKey) && instance->m_entries.txtFingerprint(logicalKey) == fingerprint) {
+            ZeroConfServiceEntry current = instance->m_entries.value(logicalKey);
+            unchanged = current.hostAddress() == hostAddress && current.port() == port && current.hostName() == QString::fromUtf8(host_name);
+        }
+
+        ZeroConfServiceEntry entry;
+        if (!unchanged) {
+            entry = ZeroConfServiceEntry(name,
+                                         key.type,
+                                         hostAddress,
+                                         key.domain,
+                                         instance->m_entries.intern(host_name),
+                                         port,
+                                         convertProtocol(protocol),
+                                         convertTxtList(txt),
+                                         flags & AVAHI_LOOKUP_RESULT_CACHED,
+                                         flags & AVAHI_LOOKUP_RESULT_WIDE_AREA,
+                                         flags & AVAHI_LOOKUP_RESULT_MULTICAST,
+                                         flags & AVAHI_LOOKUP_RESULT_LOCAL,
+                                         flags & AVAHI_LOOKUP_RESULT_OUR_OWN);
+        }
+
+        if (unchanged || !instance->isBrowsed(key.type)) {
+            // Nothing to report, or not of interest any more and updateEntry() would drop it too
+        } else if (instance->m_hostAddressCacheEnabled && !address && instance->browseProfile(key.type).testFlag(BrowseProfileAddress)) {
+            instance->m_resolvedInterfaces.insert(logicalKey, interface);
+            instance->resolveHostAddress(logicalKey, interface, entry, flags);
+        } else {
+            instance->updateEntry(logicalKey, entry);
+            if (instance->m_entries.contains(logicalKey)) {
+                instance->m_resolvedInterfaces.insert(logicalKey, interface);
+                instance->m_entries.setTxtFingerprint(logicalKey, fingerprint);
+            }
+        }
+
+        // Subscribers might have caused the resolver to be freed already
+        if (!instance->m_resolvers.contains(resolver)) {
+            return;
+        }
+
+        // Keep resolvers for subscribed types running so changes can be reported in place
+        if (instance->m_persistentResolversEnabled && instance->m_subscriptions.contains(key.type)) {
+            if (!instance->m_persistentResolvers.contains(resolver)) {
+                instance->m_persistentResolvers.insert(resolver);
+                instance->countOutstandingResolve(key.type, -1);
+                instance->processResolveQueue();
+                instance->checkInitialScan(key.type);
+            }
+            return;
+        }
+        break;
+    }
+    }
+
+    instance->freeServiceResolver(resolver);
+
+    instance->processResolveQueue();
+    instance->checkInitialScan(key.type);
+}
+
+void QtAvahiServiceBrowser::updateEntry(const QtAvahiServiceEntryStore::Key &key, const ZeroConfServiceEntry &entry)
+{
+    // The type might not be of interest any more since the resolver has been started
+    if (!isBrowsed(key.type)) {
+        return;
+    }
+
+    if (m_entries.contains(key)) {
+        ZeroConfServiceEntry oldEntry = m_entries.value(key);
+        if (oldEntry == entry) {
+            return;
+        }
+        // The service changed (e.g. TXT record or address), replace the stale entry
+        m_entries.insert(key, entry);
+        qCDebug(dcPlatformZeroConf()) << "Service updated:" << entry;
+        if (m_persistentResolversEnabled) {
+            dispatchServiceUpdated(oldEntry, entry);
+        } else {
+            dispatchServiceRemoved(oldEntry);
+            dispatchServiceAdded(entry);
+        }
+        return;
+    }
+
+    m_entries.insert(key, entry);
+    if (m_serviceHosts.contains(key)) {
+        // Was waiting for the address of its host
+        countOutstandingResolve(key.type, -1);
+    }
+    qCDebug(dcPlatformZeroConf()) << "Service added:" << entry;
+    dispatchServiceAdded(entry);
+
+    // Subscribers might have removed the type in the meantime
+    while (m_maxEntriesPerType > 0 && m_entries.count(key.type) > m_maxEntriesPerType) {
+        QtAvahiServiceEntryStore::Key oldest = m_entries.leastRecentlySeen(key.type);
+        qCDebug(dcPlatformZeroConf()) << "Service type" << key.type << "exceeds" << m_maxEntriesPerType << "entries";
+        evictEntry(oldest);
+    }
+}
+
+void QtAvahiServiceBrowser::freePersistentResolvers(const QString &serviceType)
+{
+    foreach (AvahiServiceResolver *resolver, m_persistentResolvers.values()) {
+        if (serviceType.isEmpty() || m_resolvers.value(resolver).type == serviceType) {
+            freeServiceResolver(resolver);
+        }
+    }
+}
+
+
+void QtAvahiServiceBrowser::hostNameResolverCallback(AvahiHostNameResolver *resolver, AvahiIfIndex interface, AvahiProtocol protocol, AvahiResolverEvent event, const char *name, const AvahiAddress *address, AvahiLookupResultFlags flags, void *userdata)
+{
+    Q_UNUSED(interface)
+    Q_UNUSED(protocol)
+    Q_UNUSED(flags)
+
+    QtAvahiServiceBrowser *instance = static_cast<QtAvahiServiceBrowser*>(userdata);
+    if (!instance->m_hostResolvers.contains(resolver)) {
+        return;
+    }
+    HostKey hostKey = instance->m_hostResolvers.value(resolver);
+
+    switch (event) {
+    case AVAHI_RESOLVER_FAILURE: {
+        qCDebug(dcPlatformZeroConf()) << "Failed to resolve host" << name;
+        instance->m_hostResolvers.remove(resolver);
+        avahi_host_name_resolver_free(resolver);
+
+        HostInfo host = instance->m_hosts.take(hostKey);
+        if (!host.address.isNull()) {
+            // The services of the host will tell us if it's really gone
+            host.resolver = nullptr;
+            instance->m_hosts.insert(hostKey, host);
+            break;
+        }
+
+        // Nothing ever resolved, resolve the services again, including their address
+        foreach (const QtAvahiServiceEntryStore::Key &key, host.services.keys()) {
+            if (instance->m_serviceHosts.remove(key) && !instance->m_entries.contains(key)) {
+                instance->countOutstandingResolve(key.type, -1);
+            }
+            instance->m_addressFallbacks.insert(key);
+            QList<AvahiIfIndex> interfaces = instance->m_entries.interfaces(key);
+            if (!interfaces.isEmpty()) {
+                QtAvahiServiceEntryStore::Key resolveKey = key;
+                resolveKey.interface = interfaces.first();
+                instance->scheduleResolveRetry(resolveKey);
+            }
+        }
+        break;
+    }
+    case AVAHI_RESOLVER_FOUND: {
         char a[AVAHI_ADDRESS_STR_MAX];
         avahi_address_snprint(a, sizeof(a), address);
         QHostAddress hostAddress = QHostAddress(QString(a));
 
-        ZeroConfServiceEntry entry(name,
-                                   type,
-                                   hostAddress,
-                                   domain,
-                                   host_name,
-                                   port,
-                                   convertProtocol(protocol),
-                                   convertTxtList(txt),
-                                   flags & AVAHI_LOOKUP_RESULT_CACHED,
-                                   flags & AVAHI_LOOKUP_RESULT_WIDE_AREA,
-                                   flags & AVAHI_LOOKUP_RESULT_MULTICAST,
-                                   flags & AVAHI_LOOKUP_RESULT_LOCAL,
-                                   flags & AVAHI_LOOKUP_RESULT_OUR_OWN);
-
-
-        if (!instance->m_entries.contains(entry)) {
-            instance->m_entries.append(entry);
-            qCDebug(dcPlatformZeroConf()) << "Service added:" << entry;
-            emit instance->serviceAdded(entry);
+        HostInfo &host = instance->m_hosts[hostKey];
+        if (host.address == hostAddress) {
+            break;
+        }
+        qCDebug(dcPlatformZeroConf()) << "Resolved host" << name << hostAddress << "for" << host.services.count() << "services";
+        host.address = hostAddress;
+
+        // Subscribers may change the hosts while handling the updates
+        QHash<QtAvahiServiceEntryStore::Key, HostInfo::Service> services = host.services;
+        QSet<QString> serviceTypes;
+        for (QHash<QtAvahiServiceEntryStore::Key, HostInfo::Service>::const_iterator it = services.constBegin(); it != services.constEnd(); ++it) {
+            if (instance->m_serviceHosts.value(it.key()) == hostKey) {
+                instance->updateEntry(it.key(), createEntry(it.value().entry, hostAddress, it.value().flags));
+                serviceTypes.insert(it.key().type);
+            }
+        }
+        foreach (const QString &serviceType, serviceTypes) {
+            instance->checkInitialScan(serviceType);
         }
         break;
     }
     }
+}
 
-    instance->m_resolvers.remove(resolver);
-    avahi_service_resolver_free(resolver);
+ZeroConfServiceEntry QtAvahiServiceBrowser::createEntry(const ZeroConfServiceEntry &entry, const QHostAddress &hostAddress, AvahiLookupResultFlags flags)
+{
+    return ZeroConfServiceEntry(entry.name(),
+                                entry.serviceType(),
+                                hostAddress,
+                                entry.domain(),
+                                entry.hostName(),
+                                entry.port(),
+                                entry.protocol(),
+                                entry.txt(),
+                                flags & AVAHI_LOOKUP_RESULT_CACHED,
+                                flags & AVAHI_LOOKUP_RESULT_WIDE_AREA,
+                                flags & AVAHI_LOOKUP_RESULT_MULTICAST,
+                                flags & AVAHI_LOOKUP_RESULT_LOCAL,
+                                flags & AVAHI_LOOKUP_RESULT_OUR_OWN);
 }
 
+quint64 QtAvahiServiceBrowser::txtFingerprint(AvahiStringList *txt)
+{
+    // 64 bit FNV-1a over the length prefixed strings, in list order so reordered records count as changed
+    quint64 hash = Q_UINT64_C(14695981039346656037);
+    for (AvahiStringList *item = txt; item; item = item->next) {
+        hash = (hash ^ static_cast<quint8>(item->size)) * Q_UINT64_C(1099511628211);
+        for (size_t i = 0; i < item->size; i++) {
+            hash = (hash ^ item->text[i]) * Q_UINT64_C(1099511628211);
+        }
+    }
+    return hash;
+}
 
 QStringList QtAvahiServiceBrowser::convertTxtList(AvahiStringList *txt)
 {
@@ -34,38 +34,179 @@
 #include <QObject>
 #include <QHash>
 #include <QHostAddress>
+#include <QTimer>
+#include <QVariantMap>
 
 #include <network/zeroconf/zeroconfserviceentry.h>
 
 #include <avahi-client/lookup.h>
 
 #include "qtavahiclient.h"
+#include "qtavahiserviceentrystore.h"
 
+class ZeroConfServiceBrowserAvahi;
 
 class QtAvahiServiceBrowser: public QObject
 {
     Q_OBJECT
 public:
+    // What subscribers need to know about a service. Services are only resolved as far as
+    // the most demanding subscriber of their type needs, host name and port come with any resolve.
+    enum BrowseProfileFlag {
+        BrowseProfilePresence = 0x00,
+        BrowseProfileTxt = 0x01,
+        BrowseProfileAddress = 0x02,
+        BrowseProfileFull = BrowseProfileTxt | BrowseProfileAddress
+    };
+    Q_DECLARE_FLAGS(BrowseProfile, BrowseProfileFlag)
+    Q_FLAG(BrowseProfile)
+
     QtAvahiServiceBrowser(QObject *parent = nullptr);
     QtAvahiServiceBrowser(QtAvahiClient* client, QObject *parent = nullptr);
     ~QtAvahiServiceBrowser();
 
-    QList<ZeroConfServiceEntry> entries();
+    QList<ZeroConfServiceEntry> entries() const;
+    QList<ZeroConfServiceEntry> entries(const QString &serviceType) const;
+    // Entries of the type announced with the subtype and/or in the domain, from snapshots like the ones above
+    QList<ZeroConfServiceEntry> entries(const QString &serviceType, const QString &subtype, const QString &domain) const;
+    QList<ZeroConfServiceEntry> filterScope(const QList<ZeroConfServiceEntry> &entries, const QString &subtype, const QString &domain) const;
+    quint64 generation(const QString &serviceType = QString()) const;
+    QList<ZeroConfServiceEntry> findByTxt(const QString &serviceType, const QString &txtKey, const QString &txtValue) const;
+    QList<ZeroConfServiceEntry> findByAddress(const QHostAddress &address, const QString &serviceType = QString()) const;
+    QList<int> interfaces(const ZeroConfServiceEntry &entry) const;
+    // Gauges of the browser state, the counters and histograms are in QtAvahiStatistics
+    QVariantMap statistics() const;
+    // Whether a subtype browser reported the entry
+    bool isSubtypeMember(const QString &subtype, const ZeroConfServiceEntry &entry) const;
+
+    // Browsing scope, to be set before subscribing
+    AvahiProtocol protocol() const;
+    void setProtocol(AvahiProtocol protocol);
+    QStringList allowedInterfaces() const;
+    void setAllowedInterfaces(const QStringList &allowedInterfaces);
+    QStringList ignoredInterfaces() const;
+    void setIgnoredInterfaces(const QStringList &ignoredInterfaces);
+
+    void subscribe(const QString &serviceType, ZeroConfServiceBrowserAvahi *subscriber, BrowseProfile browseProfile = BrowseProfileFull);
+    void unsubscribe(const QString &serviceType, ZeroConfServiceBrowserAvahi *subscriber);
+
+    int maxConcurrentResolvers() const;
+    void setMaxConcurrentResolvers(int maxConcurrentResolvers);
+
+    int resolveQueueDepth() const;
+    // More services waiting to be resolved than the threshold, 0 disables the check
+    bool resolveBacklog() const;
+    int resolveBacklogThreshold() const;
+    void setResolveBacklogThreshold(int resolveBacklogThreshold);
+    int activeResolverCount() const;
+    int persistentResolverCount() const;
+
+    bool persistentResolversEnabled() const;
+    void setPersistentResolversEnabled(bool persistentResolversEnabled);
+
+    int maxResolveRetries() const;
+    void setMaxResolveRetries(int maxResolveRetries);
+    int resolveRetryInterval() const;
+    void setResolveRetryInterval(int resolveRetryInterval);
+
+    QStringList pendingResolveRetries() const;
+
+    // Entries are restored from the cache file right away and written back periodically
+    QString cacheFile() const;
+    void setCacheFile(const QString &cacheFile);
+    bool saveCache() const;
+
+    bool hostAddressCacheEnabled() const;
+    void setHostAddressCacheEnabled(bool hostAddressCacheEnabled);
+    int hostAddressCacheCount() const;
+
+    int removalGracePeriod() const;
+    void setRemovalGracePeriod(int removalGracePeriod);
+    int pendingRemovalCount() const;
+    int absorbedRemovalCount() const;
+    int expiredRemovalCount() const;
+
+    // Entries no browser reports any more are evicted once they haven't been seen for the maximum age
+    int entryMaxAge() const;
+    void setEntryMaxAge(int entryMaxAge);
+    // Least recently seen entries are evicted once a type exceeds the limit, 0 means unlimited
+    int maxEntriesPerType() const;
+    void setMaxEntriesPerType(int maxEntriesPerType);
 
 signals:
     void serviceAdded(const ZeroConfServiceEntry &entry);
     void serviceRemoved(const ZeroConfServiceEntry &entry);
+    void serviceUpdated(const ZeroConfServiceEntry &oldEntry, const ZeroConfServiceEntry &newEntry);
+    // Only emitted when the resolve queue crosses the backlog threshold
+    void resolveBacklogChanged(bool resolveBacklog);
+
+private slots:
+    void onClientStateChanged(AvahiClientState state);
+    void onClientAboutToReset();
 
 private:
-    void registerServiceBrowser(const QString &serviceType, const QString &domain, AvahiIfIndex interface, AvahiProtocol protocol);
+    void freeAvahiObjects();
+    void loadCache();
+    void evictStaleEntries(const QString &serviceType, AvahiProtocol protocol);
+
+    void registerServiceTypeBrowser();
+    void unregisterServiceTypeBrowser();
+
+    void registerServiceBrowser(const QString &serviceType, const QString &domain, AvahiIfIndex interface, AvahiProtocol protocol, const QString &subtype = QString());
     void unregisterServiceBrowser(const QString &serviceType, const QString &domain, AvahiIfIndex interface, AvahiProtocol protocol);
+    void updateServiceBrowsers(const QString &serviceType);
+    bool isSeenByOtherBrowser(AvahiServiceBrowser *browser, const QtAvahiServiceEntryStore::Key &key) const;
+    void addBrowserService(AvahiServiceBrowser *browser, const QtAvahiServiceEntryStore::Key &key);
+    void removeBrowserService(AvahiServiceBrowser *browser, const QtAvahiServiceEntryStore::Key &key);
+    void releaseBrowserServices(const QSet<QtAvahiServiceEntryStore::Key> &services);
+    void addSubtypeMember(const QtAvahiServiceEntryStore::Key &key, const QString &subtype);
+    void removeSubtypeMember(const QtAvahiServiceEntryStore::Key &key, const QString &subtype);
+    bool matchesScope(ZeroConfServiceBrowserAvahi *subscriber, const ZeroConfServiceEntry &entry) const;
+
+    void enqueueServiceResolver(const QtAvahiServiceEntryStore::Key &key);
+    void cancelServiceResolver(const QtAvahiServiceEntryStore::Key &key);
+    void processResolveQueue();
+    void updateResolveBacklog();
+    bool registerServiceResolver(const QtAvahiServiceEntryStore::Key &key);
+    void freeServiceResolver(AvahiServiceResolver *resolver);
+    void countOutstandingResolve(const QString &serviceType, int delta);
+    void scheduleResolveRetry(const QtAvahiServiceEntryStore::Key &key);
+    void freePersistentResolvers(const QString &serviceType = QString());
 
-    void registerServiceResolver(const QString &name, const QString &type, const QString &domain, AvahiIfIndex interface, AvahiProtocol protocol);
+    void updateEntry(const QtAvahiServiceEntryStore::Key &key, const ZeroConfServiceEntry &entry);
+
+    void schedulePendingRemoval(const QtAvahiServiceEntryStore::Key &key);
+    ZeroConfServiceEntry takeEntry(const QtAvahiServiceEntryStore::Key &key);
+    void evictEntry(const QtAvahiServiceEntryStore::Key &key);
+    void sweepEntries();
+
+    void resolveHostAddress(const QtAvahiServiceEntryStore::Key &key, AvahiIfIndex interface, const ZeroConfServiceEntry &entry, AvahiLookupResultFlags flags);
+    void releaseHost(const QtAvahiServiceEntryStore::Key &key);
+    void expireHosts();
+
+    BrowseProfile browseProfile(const QString &serviceType) const;
+    void upgradeEntries(const QString &serviceType);
+
+    bool isInterfaceBrowsed(AvahiIfIndex interface) const;
+    static bool matchesInterface(const QStringList &patterns, const QString &interfaceName);
+    bool isBrowsed(const QString &serviceType) const;
+    void removeEntries(const QString &serviceType);
+    void checkInitialScan(const QString &serviceType);
+
+    void dispatchServiceAdded(const ZeroConfServiceEntry &entry);
+    void dispatchServiceRemoved(const ZeroConfServiceEntry &entry);
+    void dispatchServiceUpdated(const ZeroConfServiceEntry &oldEntry, const ZeroConfServiceEntry &newEntry);
+    void dispatchInitialScanFinished(const QString &serviceType);
+    QList<ZeroConfServiceBrowserAvahi*> subscribers(const QString &serviceType) const;
+    bool isSubscribed(const QString &serviceType, ZeroConfServiceBrowserAvahi *subscriber) const;
 
     static void serviceTypeBrowserCallback(AvahiServiceTypeBrowser *browser, AvahiIfIndex interface, AvahiProtocol protocol, AvahiBrowserEvent event, const char *type, const char *domain, AvahiLookupResultFlags flags, void *userdata);
     static void serviceBrowserCallback(AvahiServiceBrowser *browser, AvahiIfIndex interface, AvahiProtocol protocol, AvahiBrowserEvent event, const char *name, const char *type, const char *domain, AvahiLookupResultFlags flags, void *userdata);
+    static void hostNameResolverCallback(AvahiHostNameResolver *resolver, AvahiIfIndex interface, AvahiProtocol protocol, AvahiResolverEvent event, const char *name, const AvahiAddress *address, AvahiLookupResultFlags flags, void *userdata);
     static void serviceResolverCallback(AvahiServiceResolver *resolver, AvahiIfIndex interface, AvahiProtocol protocol, AvahiResolverEvent event, const char *name, const char *type, const char *domain, const char *host_name, const AvahiAddress *address, uint16_t port, AvahiStringList *txt, AvahiLookupResultFlags flags, void *userdata);
 
+    static ZeroConfServiceEntry createEntry(const ZeroConfServiceEntry &entry, const QHostAddress &hostAddress, AvahiLookupResultFlags flags);
+    static quint64 txtFingerprint(AvahiStringList *txt);
     static QStringList convertTxtList(AvahiStringList *txt);
     static QAbstractSocket::NetworkLayerProtocol convertProtocol(const AvahiProtocol &protocol);
 
@@ -74,17 +215,114 @@ private:
 
     AvahiServiceTypeBrowser *m_serviceTypeBrowser = nullptr;
 
+    AvahiProtocol m_protocol = AVAHI_PROTO_UNSPEC;
+    QStringList m_allowedInterfaces;
+    QStringList m_ignoredInterfaces;
+
+    // Browsers for a subtype report the services of the base type announced with it
     struct BrowserInfo {
         QString type;
+        QString subtype;
         QString domain;
         AvahiIfIndex interface;
         AvahiProtocol protocol;
+        bool allForNow = false;
+        // Services currently reported by this browser
+        QSet<QtAvahiServiceEntryStore::Key> services;
+        bool isSameBrowser(const BrowserInfo &other) const {
+            return type == other.type && subtype == other.subtype && domain == other.domain && interface == other.interface && protocol == other.protocol;
+        }
     };
     QHash<AvahiServiceBrowser*, BrowserInfo> m_serviceBrowsers;
+    // Number of browsers reporting a service, by logical key, on any interface
+    QHash<QtAvahiServiceEntryStore::Key, int> m_browserServiceCounts;
+
+    // Subscribers per service type. Wildcard subscribers (empty type) enable the type browser.
+    QHash<QString, QList<ZeroConfServiceBrowserAvahi*>> m_subscriptions;
+    QList<ZeroConfServiceBrowserAvahi*> m_wildcardSubscriptions;
+    QHash<ZeroConfServiceBrowserAvahi*, BrowseProfile> m_browseProfiles;
+    QList<BrowserInfo> m_discoveredTypes;
 
-    QSet<AvahiServiceResolver*> m_resolvers;
+    QHash<AvahiServiceResolver*, QtAvahiServiceEntryStore::Key> m_resolvers;
+    QHash<QtAvahiServiceEntryStore::Key, AvahiServiceResolver*> m_resolversByKey;
+    // Resolvers kept alive after they found their service, they don't count as in flight
+    QSet<AvahiServiceResolver*> m_persistentResolvers;
+    bool m_persistentResolversEnabled = false;
 
-    QList<ZeroConfServiceEntry> m_entries;
+    // Pending resolves, subscribed types are resolved before the ones only the type browser reported.
+    // Cancelled keys are removed from m_queuedResolves only and skipped when dequeued.
+    QList<QtAvahiServiceEntryStore::Key> m_resolveQueue;
+    QList<QtAvahiServiceEntryStore::Key> m_wildcardResolveQueue;
+    QSet<QtAvahiServiceEntryStore::Key> m_queuedResolves;
+    int m_maxConcurrentResolvers = 16;
+    int m_resolveBacklogThreshold = 64;
+    bool m_resolveBacklog = false;
+
+    // Failed resolves are retried with exponential backoff until the retry budget is used up
+    struct ResolveRetry {
+        int attempt = 0;
+        qint64 dueTime = 0;
+    };
+    QHash<QtAvahiServiceEntryStore::Key, ResolveRetry> m_resolveRetries;
+    // When services waiting to be resolved were reported by their browser
+    QHash<QtAvahiServiceEntryStore::Key, qint64> m_discoveryTimes;
+    int m_maxResolveRetries = 6;
+    int m_resolveRetryInterval = 2000;
+    int m_maxResolveRetryInterval = 300000;
+
+    // With the host address cache enabled, services are resolved without their address and
+    // completed from a host name resolver shared by all services of the host. The resolver
+    // keeps running while services depend on it, so address changes update all of them.
+    typedef QPair<QString, AvahiProtocol> HostKey;
+    struct HostInfo {
+        AvahiHostNameResolver *resolver = nullptr;
+        QHostAddress address;
+        // Cached addresses of hosts without services are kept until then
+        qint64 expiry = 0;
+        // Resolved services of the host, without address
+        struct Service {
+            ZeroConfServiceEntry entry;
+            AvahiLookupResultFlags flags;
+        };
+        QHash<QtAvahiServiceEntryStore::Key, Service> services;
+    };
+    QHash<HostKey, HostInfo> m_hosts;
+    QHash<AvahiHostNameResolver*, HostKey> m_hostResolvers;
+    QHash<QtAvahiServiceEntryStore::Key, HostKey> m_serviceHosts;
+    // Services whose host failed to resolve, resolved including their address until they succeed once
+    QSet<QtAvahiServiceEntryStore::Key> m_addressFallbacks;
+    bool m_hostAddressCacheEnabled = false;
+    int m_hostAddressLifetime = 120000;
+
+    // Removed entries are held back for the grace period so flapping services don't cause remove/add churn
+    QHash<QtAvahiServiceEntryStore::Key, qint64> m_pendingRemovals;
+    int m_removalGracePeriod = 0;
+    int m_absorbedRemovalCount = 0;
+    int m_expiredRemovalCount = 0;
+
+    // Swept in batches, a full round over all entries takes a few intervals on large networks
+    QTimer m_sweepTimer;
+    QList<QtAvahiServiceEntryStore::Key> m_sweepQueue;
+    int m_entryMaxAge = 1800000;
+    int m_maxEntriesPerType = 0;
+
+    // Entries are stored once per service and protocol, resolved on one of the interfaces it's announced on
+    QString m_cacheFile;
+    QTimer m_cacheTimer;
+
+    QtAvahiServiceEntryStore m_entries;
+    QHash<QtAvahiServiceEntryStore::Key, AvahiIfIndex> m_resolvedInterfaces;
+    // Entries kept over a client reset which haven't been reported again yet
+    QSet<QtAvahiServiceEntryStore::Key> m_staleEntries;
+    bool m_clientConnected = false;
+
+    // Types which reported all-for-now but still have initial resolves in flight, and types done with that
+    QSet<QString> m_initialScanPending;
+    QSet<QString> m_initialScanFinished;
+    // Queued and running resolves per type, including resolved services waiting for the address of their host
+    QHash<QString, int> m_outstandingResolves;
 };
 
+Q_DECLARE_OPERATORS_FOR_FLAGS(QtAvahiServiceBrowser::BrowseProfile)
+
 #endif // AVAHISERVICEBROWSER_H
@@ -0,0 +1,598 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* Copyright 2013 - 2020, nymea GmbH
+* Contact: contact@nymea.io
+*
+* This file is part of nymea.
+* This project including source code and documentation is protected by
+* copyright law, and remains the property of nymea GmbH. All rights, including
+* reproduction, publication, editing and translation, are reserved. The use of
+* this project is subject to the terms of a license agreement to be concluded
+* with nymea GmbH in accordance with the terms of use of nymea GmbH, available
+* under https://nymea.io/license
+*
+* GNU Lesser General Public License Usage
+* Alternatively, this project may be redistributed and/or modified under the
+* terms of the GNU Lesser General Public License as published by the Free
+* Software Foundation; version 3. This project is distributed in the hope that
+* it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+* warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this project. If not, see <https://www.gnu.org/licenses/>.
+*
+* For any further details and any questions please contact us under
+* contact@nymea.io or see our FAQ/Licensing Information on
+* https://nymea.io/license/faq
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include "qtavahiserviceentrystore.h"
+
+#include <QDateTime>
+
+QtAvahiServiceEntryStore::Key::Key(const QString &name, const QString &type, const QString &domain, AvahiIfIndex interface, AvahiProtocol protocol):
+    name(name),
+    type(type),
+    domain(domain),
+    interface(interface),
+    protocol(protocol)
+{
+}
+
+bool QtAvahiServiceEntryStore::Key::operator==(const Key &other) const
+{
+    return name == other.name && type == other.type && domain == other.domain && interface == other.interface && protocol == other.protocol;
+}
+
+QtAvahiServiceEntryStore::Key QtAvahiServiceEntryStore::logicalKey(const Key &key)
+{
+    Key logicalKey = key;
+    logicalKey.interface = AVAHI_IF_UNSPEC;
+    return logicalKey;
+}
+
+QtAvahiServiceEntryStore::Key QtAvahiServiceEntryStore::entryKey(const ZeroConfServiceEntry &entry)
+{
+    AvahiProtocol protocol = entry.protocol() == QAbstractSocket::IPv6Protocol ? AVAHI_PROTO_INET6 : AVAHI_PROTO_INET;
+    return Key(entry.name(), entry.serviceType(), entry.domain(), AVAHI_IF_UNSPEC, protocol);
+}
+
+bool QtAvahiServiceEntryStore::contains(const Key &key) const
+{
+    QHash<QString, QHash<Key, ZeroConfServiceEntry>>::const_iterator it = m_entries.constFind(key.type);
+    return it != m_entries.constEnd() && it.value().contains(key);
+}
+
+ZeroConfServiceEntry QtAvahiServiceEntryStore::value(const Key &key) const
+{
+    return m_entries.value(key.type).value(key);
+}
+
+void QtAvahiServiceEntryStore::insert(const Key &key, const ZeroConfServiceEntry &entry)
+{
+    QMutexLocker locker(&m_mutex);
+    m_typeGenerations.insert(key.type, ++m_generation);
+    QHash<Key, ZeroConfServiceEntry> &typeEntries = m_entries[key.type];
+    QHash<Key, ZeroConfServiceEntry>::iterator it = typeEntries.find(key);
+    if (it == typeEntries.end()) {
+        m_count++;
+        typeEntries.insert(key, entry);
+    } else {
+        if (m_indexed) {
+            removeFromIndexes(key, it.value());
+        }
+        it.value() = entry;
+    }
+    if (m_indexed) {
+        addToIndexes(key, entry);
+    }
+    locker.unlock();
+
+    setLastSeen(key, QDateTime::currentMSecsSinceEpoch());
+}
+
+ZeroConfServiceEntry QtAvahiServiceEntryStore::take(const Key &key)
+{
+    QMutexLocker locker(&m_mutex);
+    QHash<QString, QHash<Key, ZeroConfServiceEntry>>::iterator it = m_entries.find(key.type);
+    if (it == m_entries.end() || !it.value().contains(key)) {
+        return ZeroConfServiceEntry();
+    }
+
+    m_typeGenerations.insert(key.type, ++m_generation);
+    ZeroConfServiceEntry entry = it.value().take(key);
+    if (it.value().isEmpty()) {
+        m_entries.erase(it);
+    }
+    m_count--;
+    if (m_indexed) {
+        removeFromIndexes(key, entry);
+    }
+    m_interfaces.remove(logicalKey(key));
+    m_txtFingerprints.remove(key);
+    removeLastSeen(key);
+    return entry;
+}
+
+QList<ZeroConfServiceEntry> QtAvahiServiceEntryStore::takeAll(const QString &serviceType)
+{
+    QMutexLocker locker(&m_mutex);
+    QHash<Key, ZeroConfServiceEntry> typeEntries = m_entries.take(serviceType);
+    QList<ZeroConfServiceEntry> entries = typeEntries.values();
+    m_count -= entries.count();
+    m_typeGenerations.insert(serviceType, ++m_generation);
+    if (m_indexed) {
+        m_txtIndexes.remove(serviceType);
+        for (QHash<Key, ZeroConfServiceEntry>::const_iterator it = typeEntries.constBegin(); it != typeEntries.constEnd(); ++it) {
+            if (!it.value().hostAddress().isNull()) {
+                m_addressIndex.remove(it.value().hostAddress(), it.key());
+            }
+        }
+    }
+    locker.unlock();
+
+    for (QHash<Key, QList<AvahiIfIndex>>::iterator it = m_interfaces.begin(); it != m_interfaces.end(); ) {
+        if (it.key().type == serviceType) {
+            it = m_interfaces.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    for (QHash<Key, quint64>::iterator it = m_txtFingerprints.begin(); it != m_txtFingerprints.end(); ) {
+        if (it.key().type == serviceType) {
+            it = m_txtFingerprints.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    foreach (const Key &key, m_seenOrder.take(serviceType)) {
+        m_lastSeen.remove(key);
+    }
+    return entries;
+}
+
+QList<ZeroConfServiceEntry> QtAvahiServiceEntryStore::entries() const
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_snapshot.generation != m_generation) {
+        QList<ZeroConfServiceEntry> entries;
+        entries.reserve(m_count);
+        foreach (const auto &typeEntries, m_entries) {
+            entries.append(typeEntries.values());
+        }
+        m_snapshot.entries = entries;
+        m_snapshot.generation = m_generation;
+    }
+    return m_snapshot.entries;
+}
+
+QList<ZeroConfServiceEntry> QtAvahiServiceEntryStore::entries(const QString &serviceType) const
+{
+    QMutexLocker locker(&m_mutex);
+    quint64 generation = m_typeGenerations.value(serviceType);
+    if (generation == 0) {
+        return QList<ZeroConfServiceEntry>();
+    }
+    Snapshot &snapshot = m_typeSnapshots[serviceType];
+    if (snapshot.generation != generation) {
+        snapshot.entries = m_entries.value(serviceType).values();
+        snapshot.generation = generation;
+    }
+    return snapshot.entries;
+}
+
+quint64 QtAvahiServiceEntryStore::generation() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_generation;
+}
+
+quint64 QtAvahiServiceEntryStore::generation(const QString &serviceType) const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_typeGenerations.value(serviceType);
+}
+
+bool QtAvahiServiceEntryStore::addSubtype(const Key &key, const QString &subtype)
+{
+    QMutexLocker locker(&m_mutex);
+    QSet<QString> &subtypes = m_subtypes[key];
+    if (subtypes.contains(subtype)) {
+        return false;
+    }
+    subtypes.insert(subtype);
+    if (contains(key)) {
+        m_typeGenerations.insert(key.type, ++m_generation);
+    }
+    return true;
+}
+
+bool QtAvahiServiceEntryStore::removeSubtype(const Key &key, const QString &subtype)
+{
+    QMutexLocker locker(&m_mutex);
+    QHash<Key, QSet<QString>>::iterator it = m_subtypes.find(key);
+    if (it == m_subtypes.end() || !it.value().remove(subtype)) {
+        return false;
+    }
+    if (it.value().isEmpty()) {
+        m_subtypes.erase(it);
+    }
+    if (contains(key)) {
+        m_typeGenerations.insert(key.type, ++m_generation);
+    }
+    return true;
+}
+
+void QtAvahiServiceEntryStore::removeSubtypes(const Key &key)
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_subtypes.remove(key) > 0 && contains(key)) {
+        m_typeGenerations.insert(key.type, ++m_generation);
+    }
+}
+
+bool QtAvahiServiceEntryStore::hasSubtype(const Key &key, const QString &subtype) const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_subtypes.value(key).contains(subtype);
+}
+
+QList<ZeroConfServiceEntry> QtAvahiServiceEntryStore::entries(const QString &serviceType, const QString &subtype, const QString &domain) const
+{
+    if (subtype.isEmpty() && domain.isEmpty()) {
+        return entries(serviceType);
+    }
+
+    QMutexLocker locker(&m_mutex);
+    quint64 generation = m_typeGenerations.value(serviceType);
+    if (generation == 0) {
+        return QList<ZeroConfServiceEntry>();
+    }
+    Snapshot &snapshot = m_scopeSnapshots[serviceType + '\n' + subtype + '\n' + domain];
+    if (snapshot.generation != generation) {
+        snapshot.entries.clear();
+        QHash<QString, QHash<Key, ZeroConfServiceEntry>>::const_iterator typeEntries = m_entries.constFind(serviceType);
+        if (typeEntries != m_entries.constEnd()) {
+            for (QHash<Key, ZeroConfServiceEntry>::const_iterator it = typeEntries.value().constBegin(); it != typeEntries.value().constEnd(); ++it) {
+                if (isInScope(it.key(), it.value(), subtype, domain)) {
+                    snapshot.entries.append(it.value());
+                }
+            }
+        }
+        snapshot.generation = generation;
+    }
+    return snapshot.entries;
+}
+
+QList<ZeroConfServiceEntry> QtAvahiServiceEntryStore::filterScope(const QList<ZeroConfServiceEntry> &entries, const QString &subtype, const QString &domain) const
+{
+    if (subtype.isEmpty() && domain.isEmpty()) {
+        return entries;
+    }
+
+    QMutexLocker locker(&m_mutex);
+    QList<ZeroConfServiceEntry> ret;
+    foreach (const ZeroConfServiceEntry &entry, entries) {
+        if (isInScope(entryKey(entry), entry, subtype, domain)) {
+            ret.append(entry);
+        }
+    }
+    return ret;
+}
+
+bool QtAvahiServiceEntryStore::isInScope(const Key &key, const ZeroConfServiceEntry &entry, const QString &subtype, const QString &domain) const
+{
+    if (!domain.isEmpty() && entry.domain() != domain) {
+        return false;
+    }
+    if (subtype.isEmpty()) {
+        return true;
+    }
+    QHash<Key, QSet<QString>>::const_iterator it = m_subtypes.constFind(key);
+    return it != m_subtypes.constEnd() && it.value().contains(subtype);
+}
+
+QList<QtAvahiServiceEntryStore::Key> QtAvahiServiceEntryStore::keys(const QString &serviceType) const
+{
+    return m_entries.value(serviceType).keys();
+}
+
+QList<QString> QtAvahiServiceEntryStore::serviceTypes() const
+{
+    return m_entries.keys();
+}
+
+int QtAvahiServiceEntryStore::count() const
+{
+    return m_count;
+}
+
+int QtAvahiServiceEntryStore::count(const QString &serviceType) const
+{
+    return m_entries.value(serviceType).count();
+}
+
+bool QtAvahiServiceEntryStore::addInterface(const Key &key)
+{
+    QList<AvahiIfIndex> &interfaces = m_interfaces[logicalKey(key)];
+    if (!interfaces.contains(key.interface)) {
+        interfaces.append(key.interface);
+    }
+    return interfaces.count() == 1;
+}
+
+int QtAvahiServiceEntryStore::removeInterface(const Key &key)
+{
+    QHash<Key, QList<AvahiIfIndex>>::iterator it = m_interfaces.find(logicalKey(key));
+    if (it == m_interfaces.end()) {
+        return 0;
+    }
+    it.value().removeAll(key.interface);
+    int remaining = it.value().count();
+    if (remaining == 0) {
+        m_interfaces.erase(it);
+    }
+    return remaining;
+}
+
+QList<AvahiIfIndex> QtAvahiServiceEntryStore::interfaces(const Key &key) const
+{
+    return m_interfaces.value(logicalKey(key));
+}
+
+void QtAvahiServiceEntryStore::clearInterfaces()
+{
+    m_interfaces.clear();
+}
+
+QList<ZeroConfServiceEntry> QtAvahiServiceEntryStore::findByTxt(const QString &serviceType, const QString &txtKey, const QString &txtValue) const
+{
+    QMutexLocker locker(&m_mutex);
+
+    if (!m_indexed) {
+        buildIndexes();
+    }
+
+    QList<ZeroConfServiceEntry> ret;
+    const QList<QString> serviceTypes = serviceType.isEmpty() ? m_txtIndexes.keys() : QList<QString>({serviceType});
+    const QString indexKey = txtIndexKey(txtKey, txtValue);
+    foreach (const QString &type, serviceTypes) {
+        QHash<QString, QMultiHash<QString, Key>>::const_iterator index = m_txtIndexes.constFind(type);
+        QHash<QString, QHash<Key, ZeroConfServiceEntry>>::const_iterator typeEntries = m_entries.constFind(type);
+        if (index == m_txtIndexes.constEnd() || typeEntries == m_entries.constEnd()) {
+            continue;
+        }
+        for (QMultiHash<QString, Key>::const_iterator it = index.value().constFind(indexKey); it != index.value().constEnd() && it.key() == indexKey; ++it) {
+            ret.append(typeEntries.value().value(it.value()));
+        }
+    }
+    return ret;
+}
+
+QList<ZeroConfServiceEntry> QtAvahiServiceEntryStore::findByAddress(const QHostAddress &address, const QString &serviceType) const
+{
+    QMutexLocker locker(&m_mutex);
+
+    if (!m_indexed) {
+        buildIndexes();
+    }
+
+    QList<ZeroConfServiceEntry> ret;
+    for (QMultiHash<QHostAddress, Key>::const_iterator it = m_addressIndex.constFind(address); it != m_addressIndex.constEnd() && it.key() == address; ++it) {
+        if (serviceType.isEmpty() || it.value().type == serviceType) {
+            ret.append(m_entries.value(it.value().type).value(it.value()));
+        }
+    }
+    return ret;
+}
+
+void QtAvahiServiceEntryStore::buildIndexes() const
+{
+    foreach (const auto &typeEntries, m_entries) {
+        for (QHash<Key, ZeroConfServiceEntry>::const_iterator it = typeEntries.constBegin(); it != typeEntries.constEnd(); ++it) {
+            addToIndexes(it.key(), it.value());
+        }
+    }
+    m_indexed = true;
+}
+
+void QtAvahiServiceEntryStore::addToIndexes(const Key &key, const ZeroConfServiceEntry &entry) const
+{
+    if (!entry.txt().isEmpty()) {
+        QMultiHash<QString, Key> &index = m_txtIndexes[key.type];
+        foreach (const QString &txt, entry.txt()) {
+            index.insert(txtIndexKey(txt), key);
+        }
+    }
+    if (!entry.hostAddress().isNull()) {
+        m_addressIndex.insert(entry.hostAddress(), key);
+    }
+}
+
+void QtAvahiServiceEntryStore::removeFromIndexes(const Key &key, const ZeroConfServiceEntry &entry) const
+{
+    QHash<QString, QMultiHash<QString, Key>>::iterator index = m_txtIndexes.find(key.type);
+    if (index != m_txtIndexes.end()) {
+        foreach (const QString &txt, entry.txt()) {
+            index.value().remove(txtIndexKey(txt), key);
+        }
+        // Types which went away don't keep their index around
+        if (index.value().isEmpty()) {
+            m_txtIndexes.erase(index);
+        }
+    }
+    if (!entry.hostAddress().isNull()) {
+        m_addressIndex.remove(entry.hostAddress(), key);
+    }
+}
+
+QString QtAvahiServiceEntryStore::txtIndexKey(const QString &txt)
+{
+    int separator = txt.indexOf('=');
+    return separator < 0 ? txtIndexKey(txt, QString()) : txtIndexKey(txt.left(separator), txt.mid(separator + 1));
+}
+
+QString QtAvahiServiceEntryStore::txtIndexKey(const QString &txtKey, const QString &txtValue)
+{
+    return txtValue.isNull() ? txtKey.toLower() : txtKey.toLower() + '=' + txtValue;
+}
+
+qint64 QtAvahiServiceEntryStore::lastSeen(const Key &key) const
+{
+    return m_lastSeen.value(key).first;
+}
+
+void QtAvahiServiceEntryStore::touch(const Key &key, qint64 timestamp)
+{
+    if (m_lastSeen.contains(key)) {
+        setLastSeen(key, timestamp);
+    }
+}
+
+QtAvahiServiceEntryStore::Key QtAvahiServiceEntryStore::leastRecentlySeen(const QString &serviceType) const
+{
+    QHash<QString, QMap<SeenStamp, Key>>::const_iterator order = m_seenOrder.constFind(serviceType);
+    if (order == m_seenOrder.constEnd() || order.value().isEmpty()) {
+        return Key();
+    }
+    return order.value().constBegin().value();
+}
+
+void QtAvahiServiceEntryStore::setLastSeen(const Key &key, qint64 timestamp)
+{
+    QMap<SeenStamp, Key> &order = m_seenOrder[key.type];
+    QHash<Key, SeenStamp>::iterator it = m_lastSeen.find(key);
+    if (it != m_lastSeen.end()) {
+        order.remove(it.value());
+        it.value() = SeenStamp(timestamp, m_seenSequence++);
+    } else {
+        it = m_lastSeen.insert(key, SeenStamp(timestamp, m_seenSequence++));
+    }
+    order.insert(it.value(), key);
+}
+
+void QtAvahiServiceEntryStore::removeLastSeen(const Key &key)
+{
+    QHash<Key, SeenStamp>::iterator it = m_lastSeen.find(key);
+    if (it == m_lastSeen.end()) {
+        return;
+    }
+    QHash<QString, QMap<SeenStamp, Key>>::iterator order = m_seenOrder.find(key.type);
+    if (order != m_seenOrder.end()) {
+        order.value().remove(it.value());
+        if (order.value().isEmpty()) {
+            m_seenOrder.erase(order);
+        }
+    }
+    m_lastSeen.erase(it);
+}
+
+quint64 QtAvahiServiceEntryStore::txtFingerprint(const Key &key) const
+{
+    return m_txtFingerprints.value(key);
+}
+
+void QtAvahiServiceEntryStore::setTxtFingerprint(const Key &key, quint64 txtFingerprint)
+{
+    if (contains(key)) {
+        m_txtFingerprints.insert(key, txtFingerprint);
+    }
+}
+
+QString QtAvahiServiceEntryStore::intern(const char *string)
+{
+    if (!string) {
+        return QString();
+    }
+
+    // Doesn't copy the data, the pool is only keyed by a copy on a miss
+    QByteArray data = QByteArray::fromRawData(string, static_cast<int>(qstrlen(string)));
+    QHash<QByteArray, QString>::const_iterator it = m_strings.constFind(data);
+    if (it != m_strings.constEnd()) {
+        return it.value();
+    }
+
+    // Drop strings nobody but the pool refers to any more
+    if (m_strings.count() >= m_stringsPruneSize) {
+        for (QHash<QByteArray, QString>::iterator it = m_strings.begin(); it != m_strings.end(); ) {
+            if (it.value().isDetached()) {
+                it = m_strings.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        m_stringsPruneSize = qMax(256, m_strings.count() * 2);
+    }
+
+    QString value = QString::fromUtf8(data);
+    m_strings.insert(QByteArray(data.constData(), data.size()), value);
+    return value;
+}
+
+static const quint32 snapshotMagic = 0x6e7a6563; // "nzec"
+static const quint16 snapshotVersion = 1;
+
+void QtAvahiServiceEntryStore::save(QDataStream &stream) const
+{
+    stream.setVersion(QDataStream::Qt_5_12);
+    stream << snapshotMagic << snapshotVersion << static_cast<quint32>(m_count);
+
+    foreach (const auto &typeEntries, m_entries) {
+        for (QHash<Key, ZeroConfServiceEntry>::const_iterator it = typeEntries.constBegin(); it != typeEntries.constEnd(); ++it) {
+            const Key &key = it.key();
+            const ZeroConfServiceEntry &entry = it.value();
+            stream << key.name << key.type << key.domain << static_cast<qint32>(key.interface) << static_cast<qint32>(key.protocol);
+            stream << entry.hostAddress() << entry.hostName() << entry.port() << static_cast<qint32>(entry.protocol()) << entry.txt();
+            stream << entry.isWideArea() << entry.isMulticast() << entry.isLocal() << entry.isOurOwn();
+        }
+    }
+}
+
+QList<QtAvahiServiceEntryStore::Key> QtAvahiServiceEntryStore::load(QDataStream &stream)
+{
+    QList<Key> keys;
+
+    stream.setVersion(QDataStream::Qt_5_12);
+    quint32 magic = 0;
+    quint16 version = 0;
+    quint32 count = 0;
+    stream >> magic >> version >> count;
+    if (stream.status() != QDataStream::Ok || magic != snapshotMagic || version != snapshotVersion) {
+        return keys;
+    }
+
+    for (quint32 i = 0; i < count; i++) {
+        Key key;
+        qint32 interface, protocol, entryProtocol;
+        QHostAddress hostAddress;
+        QString hostName;
+        quint16 port;
+        QStringList txt;
+        bool isWideArea, isMulticast, isLocal, isOurOwn;
+        stream >> key.name >> key.type >> key.domain >> interface >> protocol;
+        stream >> hostAddress >> hostName >> port >> entryProtocol >> txt;
+        stream >> isWideArea >> isMulticast >> isLocal >> isOurOwn;
+        if (stream.status() != QDataStream::Ok) {
+            break;
+        }
+        key.interface = interface;
+        key.protocol = protocol;
+        if (contains(key)) {
+            continue;
+        }
+
+        insert(key, ZeroConfServiceEntry(key.name, key.type, hostAddress, key.domain, hostName, port,
+                                         static_cast<QAbstractSocket::NetworkLayerProtocol>(entryProtocol), txt,
+                                         true, isWideArea, isMulticast, isLocal, isOurOwn));
+        keys.append(key);
+    }
+    return keys;
+}
+
+uint qHash(const QtAvahiServiceEntryStore::Key &key, uint seed)
+{
+    return qHash(key.name, seed) ^ qHash(key.type, seed) ^ qHash(key.domain, seed) ^ qHash(static_cast<int>(key.interface), seed) ^ qHash(static_cast<int>(key.protocol), seed);
+}
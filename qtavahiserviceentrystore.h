@@ -0,0 +1,181 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* Copyright 2013 - 2020, nymea GmbH
+* Contact: contact@nymea.io
+*
+* This file is part of nymea.
+* This project including source code and documentation is protected by
+* copyright law, and remains the property of nymea GmbH. All rights, including
+* reproduction, publication, editing and translation, are reserved. The use of
+* this project is subject to the terms of a license agreement to be concluded
+* with nymea GmbH in accordance with the terms of use of nymea GmbH, available
+* under https://nymea.io/license
+*
+* GNU Lesser General Public License Usage
+* Alternatively, this project may be redistributed and/or modified under the
+* terms of the GNU Lesser General Public License as published by the Free
+* Software Foundation; version 3. This project is distributed in the hope that
+* it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+* warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this project. If not, see <https://www.gnu.org/licenses/>.
+*
+* For any further details and any questions please contact us under
+* contact@nymea.io or see our FAQ/Licensing Information on
+* https://nymea.io/license/faq
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#ifndef QTAVAHISERVICEENTRYSTORE_H
+#define QTAVAHISERVICEENTRYSTORE_H
+
+#include <QHash>
+#include <QList>
+#include <QMap>
+#include <QPair>
+#include <QString>
+#include <QByteArray>
+#include <QDataStream>
+#include <QSet>
+#include <QMutex>
+#include <QMultiHash>
+#include <QHostAddress>
+
+#include <network/zeroconf/zeroconfserviceentry.h>
+
+#include <avahi-common/address.h>
+
+class QtAvahiServiceEntryStore
+{
+public:
+    class Key {
+    public:
+        Key() = default;
+        Key(const QString &name, const QString &type, const QString &domain, AvahiIfIndex interface, AvahiProtocol protocol);
+
+        QString name;
+        QString type;
+        QString domain;
+        AvahiIfIndex interface = AVAHI_IF_UNSPEC;
+        AvahiProtocol protocol = AVAHI_PROTO_UNSPEC;
+
+        bool operator==(const Key &other) const;
+    };
+
+    // The same service announced on several interfaces is stored once,
+    // under its key with the interface set to AVAHI_IF_UNSPEC
+    static Key logicalKey(const Key &key);
+    // Logical key of an entry handed out by the store
+    static Key entryKey(const ZeroConfServiceEntry &entry);
+
+    bool contains(const Key &key) const;
+    ZeroConfServiceEntry value(const Key &key) const;
+
+    void insert(const Key &key, const ZeroConfServiceEntry &entry);
+    ZeroConfServiceEntry take(const Key &key);
+    QList<ZeroConfServiceEntry> takeAll(const QString &serviceType);
+
+    // Immutable snapshots, rebuilt once per change and shared by all readers until the next one.
+    // Safe to call from other threads than the one modifying the store.
+    QList<ZeroConfServiceEntry> entries() const;
+    QList<ZeroConfServiceEntry> entries(const QString &serviceType) const;
+    // Increases with every change, per type or of the whole store
+    quint64 generation() const;
+    quint64 generation(const QString &serviceType) const;
+
+    // Subtypes an entry has been announced with. Changes of entries present in the store count as
+    // changes of their type. Thread safe, like the scoped views built from them.
+    bool addSubtype(const Key &key, const QString &subtype);
+    bool removeSubtype(const Key &key, const QString &subtype);
+    void removeSubtypes(const Key &key);
+    bool hasSubtype(const Key &key, const QString &subtype) const;
+    // Snapshot of the entries of a type announced with the subtype and/or in the domain, empty ones match everything
+    QList<ZeroConfServiceEntry> entries(const QString &serviceType, const QString &subtype, const QString &domain) const;
+    QList<ZeroConfServiceEntry> filterScope(const QList<ZeroConfServiceEntry> &entries, const QString &subtype, const QString &domain) const;
+
+    // Lookups through indexes built on first use and kept up to date by every change from then on.
+    // TXT keys are case insensitive, an empty type searches all types.
+    QList<ZeroConfServiceEntry> findByTxt(const QString &serviceType, const QString &txtKey, const QString &txtValue) const;
+    QList<ZeroConfServiceEntry> findByAddress(const QHostAddress &address, const QString &serviceType = QString()) const;
+    QList<Key> keys(const QString &serviceType) const;
+    QList<QString> serviceTypes() const;
+
+    int count() const;
+    int count(const QString &serviceType) const;
+
+    // Interfaces a service is currently announced on, tracked for resolved and unresolved services
+    bool addInterface(const Key &key);
+    int removeInterface(const Key &key);
+    QList<AvahiIfIndex> interfaces(const Key &key) const;
+    void clearInterfaces();
+
+    // Time in ms since epoch an entry was last inserted or confirmed to be still around
+    qint64 lastSeen(const Key &key) const;
+    void touch(const Key &key, qint64 timestamp);
+    // Taken from the eviction order of the type, without looking at its other entries
+    Key leastRecentlySeen(const QString &serviceType) const;
+
+    // Fingerprint of the TXT record the entry was decoded from, to tell whether a resolve changed anything without decoding it
+    quint64 txtFingerprint(const Key &key) const;
+    void setTxtFingerprint(const Key &key, quint64 txtFingerprint);
+
+    // Service types, domains and host names repeat across entries, hand out shared copies.
+    // Looked up by the raw UTF-8 data, only strings not in the pool yet are decoded.
+    QString intern(const char *string);
+
+    // Versioned binary snapshot of all entries. Loaded entries are marked as cached.
+    void save(QDataStream &stream) const;
+    QList<Key> load(QDataStream &stream);
+
+private:
+    // Entries are indexed by their service type first, the key holds the type as well
+    QHash<QString, QHash<Key, ZeroConfServiceEntry>> m_entries;
+    int m_count = 0;
+    // Time seen plus a sequence number, unique per entry so that entries seen within the same ms
+    // keep their own place in the eviction order of their type
+    typedef QPair<qint64, quint64> SeenStamp;
+    QHash<Key, SeenStamp> m_lastSeen;
+    QHash<QString, QMap<SeenStamp, Key>> m_seenOrder;
+    quint64 m_seenSequence = 0;
+    void setLastSeen(const Key &key, qint64 timestamp);
+    void removeLastSeen(const Key &key);
+
+    // Guards modifications of m_entries against snapshot rebuilds on other threads
+    mutable QMutex m_mutex;
+    quint64 m_generation = 1;
+    QHash<QString, quint64> m_typeGenerations;
+    struct Snapshot {
+        quint64 generation = 0;
+        QList<ZeroConfServiceEntry> entries;
+    };
+    mutable Snapshot m_snapshot;
+    mutable QHash<QString, Snapshot> m_typeSnapshots;
+
+    QHash<Key, QSet<QString>> m_subtypes;
+    // Keyed by type, subtype and domain
+    mutable QHash<QString, Snapshot> m_scopeSnapshots;
+    bool isInScope(const Key &key, const ZeroConfServiceEntry &entry, const QString &subtype, const QString &domain) const;
+
+    // Only maintained once somebody looked something up, guarded by m_mutex
+    mutable bool m_indexed = false;
+    mutable QHash<QString, QMultiHash<QString, Key>> m_txtIndexes;
+    mutable QMultiHash<QHostAddress, Key> m_addressIndex;
+    void buildIndexes() const;
+    void addToIndexes(const Key &key, const ZeroConfServiceEntry &entry) const;
+    void removeFromIndexes(const Key &key, const ZeroConfServiceEntry &entry) const;
+    static QString txtIndexKey(const QString &txt);
+    static QString txtIndexKey(const QString &txtKey, const QString &txtValue);
+
+    QHash<Key, QList<AvahiIfIndex>> m_interfaces;
+    QHash<Key, quint64> m_txtFingerprints;
+
+    QHash<QByteArray, QString> m_strings;
+    int m_stringsPruneSize = 256;
+};
+
+uint qHash(const QtAvahiServiceEntryStore::Key &key, uint seed = 0);
+
+#endif // QTAVAHISERVICEENTRYSTORE_H
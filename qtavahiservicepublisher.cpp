@@ -30,13 +30,19 @@
 
 #include "qtavahiservicepublisher.h"
 #include "qtavahiclient.h"
+#include "qtavahiinterfacecache.h"
+#include "qtavahistatistics.h"
 
-#include <QNetworkInterface>
+#include <QDateTime>
+#include <QRandomGenerator>
+
+#include <limits>
 
 #include <loggingcategories.h>
 
 #include <avahi-common/error.h>
 #include <avahi-common/alternative.h>
+#include <avahi-common/malloc.h>
 
 QtAvahiServicePublisher::QtAvahiServicePublisher(QObject *parent):
     QtAvahiServicePublisher(new QtAvahiClient(this), parent)
@@ -47,25 +53,52 @@ QtAvahiServicePublisher::QtAvahiServicePublisher(QtAvahiClient *client, QObject
     QObject(parent),
     m_client(client)
 {
-    // Reregister every minute in order to work around low quality network hardware which
+    connect(m_client, &QtAvahiClient::stateChanged, this, &QtAvahiServicePublisher::onClientStateChanged);
+    connect(m_client, &QtAvahiClient::aboutToReset, this, &QtAvahiServicePublisher::onClientAboutToReset);
+
+    m_interfaceCache = new QtAvahiInterfaceCache(this);
+    connect(m_interfaceCache, &QtAvahiInterfaceCache::interfacesChanged, this, &QtAvahiServicePublisher::onInterfacesChanged);
+
+    // Refresh services every minute in order to work around low quality network hardware which
     // doesn't properly keep multicast sessions alive.
     // https://bugs.debian.org/cgi-bin/bugreport.cgi?bug=736641
-    m_reregisterTimer.setInterval(60000);
-    m_reregisterTimer.setSingleShot(false);
+    // Each service is refreshed on its own schedule so the refreshes are spread over the interval.
+    m_reregisterTimer.setSingleShot(true);
     connect(&m_reregisterTimer, &QTimer::timeout, this, [this](){
-        foreach (ServiceInfo *info, m_services) {
-            qCDebug(dcPlatformZeroConf()) << "Re-registering avahi service" << info->name;
-            unregisterServiceInternal(info);
-            registerServiceInternal(info);
+        // Queued services are registered as soon as the client is running
+        if (m_client->isRunning()) {
+            qint64 now = QDateTime::currentMSecsSinceEpoch();
+            foreach (ServiceInfo *info, m_services) {
+                if (info->refreshInterval > 0 && info->nextRefresh <= now) {
+                    refreshServiceInternal(info);
+                    info->nextRefresh = now + jitter(info->refreshInterval, 10);
+                }
+            }
         }
+        scheduleRefresh();
     });
 }
-
 QtAvahiServicePublisher::~QtAvahiServicePublisher()
 {
-    foreach (const QString &service, m_services.keys()) {
-        unregisterService(service);
+    // Freeing the entry groups withdraws all services at once, unregisterService() would
+    // register the remaining services of shared groups again on the way.
+    foreach (ServiceGroup *group, m_groups) {
+        if (group->group) {
+            avahi_entry_group_free(group->group);
+        }
+        delete group;
+    }
+    m_groups.clear();
+    m_groupsByEntryGroup.clear();
+    delete m_batch;
+
+    foreach (ServiceInfo *info, m_services) {
+        if (info->serviceList) {
+            avahi_string_list_free(info->serviceList);
+        }
+        delete info;
     }
+    m_services.clear();
 }
 
 bool QtAvahiServicePublisher::registerService(const QString &name, const QHostAddress &hostAddress, const quint16 &port, const QString &serviceType, const QHash<QString, QString> &txtRecords)
@@ -77,19 +110,39 @@ bool QtAvahiServicePublisher::registerService(const QString &name, const QHostAd
     // Cache all values locally at first
     ServiceInfo *info = new ServiceInfo();
     info->name = name;
-    info->effectiveName = name;
+    setEffectiveName(info, name);
     info->hostAddress = hostAddress;
     info->port = port;
     info->serviceType = serviceType;
+    info->serviceTypeData = serviceType.toUtf8();
     info->txtRecords = txtRecords;
-    info->group = avahi_entry_group_new(m_client->m_client, QtAvahiServicePublisher::callback, this);
-
+    info->serviceList = createTxtList(txtRecords);
+    info->refreshInterval = m_defaultRefreshInterval;
+    // Services registered together (e.g. at startup) don't refresh at the same time
+    info->nextRefresh = QDateTime::currentMSecsSinceEpoch() + info->refreshInterval / 2 + QRandomGenerator::global()->bounded(info->refreshInterval / 2 + 1);
     m_services.insert(name, info);
-    m_servicesByGroup.insert(info->group, info);
 
-    registerServiceInternal(info);
+    scheduleRefresh();
+
+    // Services registered in a batch are committed together in commitBatch()
+    if (m_batch) {
+        qCDebug(dcPlatformZeroConf()) << "Adding service" << name << "to batch";
+        info->group = m_batch;
+        m_batch->services.append(info);
+        return true;
+    }
+
+    info->group = new ServiceGroup();
+    info->group->services.append(info);
+    m_groups.append(info->group);
+
+    // Registrations made before the client is up are committed once it reports running
+    if (!m_client->isRunning()) {
+        qCDebug(dcPlatformZeroConf()) << "Avahi client not running yet. Queueing registration of service" << name;
+        return true;
+    }
 
-    m_reregisterTimer.start();
+    registerGroupInternal(info->group);
 
     return true;
 }
@@ -103,100 +156,373 @@ void QtAvahiServicePublisher::unregisterService(const QString &name)
     qCDebug(dcPlatformZeroConf()) << "Unregistering service" << name;
 
     ServiceInfo *info = m_services.take(name);
-    m_servicesByGroup.remove(info->group);
-    unregisterServiceInternal(info);
-    avahi_entry_group_free(info->group);
+    ServiceGroup *group = info->group;
+    group->services.removeAll(info);
+    if (info->serviceList) {
+        avahi_string_list_free(info->serviceList);
+    }
     delete info;
 
-    if (m_services.isEmpty()) {
-        m_reregisterTimer.stop();
+    if (group != m_batch) {
+        // Single services can't be removed from an entry group, the remaining ones are registered again
+        unregisterGroupInternal(group);
+        if (group->services.isEmpty()) {
+            m_groups.removeAll(group);
+            if (group->group) {
+                m_groupsByEntryGroup.remove(group->group);
+                avahi_entry_group_free(group->group);
+            }
+            delete group;
+        } else {
+            registerGroupInternal(group);
+        }
     }
+
+    scheduleRefresh();
 }
 
-bool QtAvahiServicePublisher::registerServiceInternal(ServiceInfo *info)
+bool QtAvahiServicePublisher::updateServiceTxt(const QString &name, const QHash<QString, QString> &txtRecords)
 {
-    // Check if the client is running
-    if (!m_client->m_client || AVAHI_CLIENT_S_RUNNING != avahi_client_get_state(m_client->m_client)) {
-        qCWarning(dcPlatformZeroConf()) << "Could not register service" << info->name << info->port << info->serviceType << ". The client is not available.";
+    ServiceInfo *info = m_services.value(name);
+    if (!info) {
+        qCWarning(dcPlatformZeroConf()) << "Cannot update TXT records. Service not registered" << name;
         return false;
     }
 
-    // Add the service
-    AvahiIfIndex ifIndex = AVAHI_IF_UNSPEC;
-    if (info->hostAddress != QHostAddress("0.0.0.0")) {
-        foreach (const QNetworkInterface &interface, QNetworkInterface::allInterfaces()) {
-            foreach (const QNetworkAddressEntry &addressEntry, interface.addressEntries()) {
-                QPair<QHostAddress, int> subnet = QHostAddress::parseSubnet(addressEntry.ip().toString() + "/" + addressEntry.netmask().toString());
-                if (info->hostAddress.isInSubnet(subnet.first, subnet.second)) {
-                    ifIndex = interface.index();
-                    break;
-                }
-            }
-        }
+    if (info->txtRecords == txtRecords) {
+        return true;
+    }
+    info->txtRecords = txtRecords;
+    if (info->serviceList) {
+        avahi_string_list_free(info->serviceList);
     }
-
     info->serviceList = createTxtList(info->txtRecords);
 
-    int error = avahi_entry_group_add_service_strlst(info->group,
-                                                     ifIndex,
-                                                     info->hostAddress.protocol() == QAbstractSocket::IPv6Protocol ? AVAHI_PROTO_INET6 : AVAHI_PROTO_INET,
-                                                     (AvahiPublishFlags) 0,
-                                                     info->effectiveName.toUtf8().data(),
-                                                     info->serviceType.toUtf8().data(),
-                                                     0,
-                                                     0,
-                                                     info->port,
-                                                     info->serviceList);
+    // Not registered (yet), the new records are used once it is
+    if (isGroupEmpty(info->group)) {
+        return true;
+    }
+
+    // Update the TXT record in place, this keeps the group established and doesn't probe again
+    qCDebug(dcPlatformZeroConf()) << "Updating TXT records of service" << name << txtRecords;
+    int error = updateServiceTxtInternal(info, info->serviceList);
 
     if (error) {
-        if (error == AVAHI_ERR_COLLISION) {
-            if (!handleCollision(info)) {
+        qCWarning(dcPlatformZeroConf()) << "Failed to update TXT records of service" << name << ":" << avahi_strerror(error) << "Re-registering it.";
+        unregisterGroupInternal(info->group);
+        return registerGroupInternal(info->group);
+    }
+    return true;
+}
+
+void QtAvahiServicePublisher::beginBatch()
+{
+    if (m_batch) {
+        qCWarning(dcPlatformZeroConf()) << "A service batch is already open. Services will be added to it.";
+        return;
+    }
+    m_batch = new ServiceGroup();
+}
+
+bool QtAvahiServicePublisher::commitBatch()
+{
+    if (!m_batch) {
+        qCWarning(dcPlatformZeroConf()) << "Cannot commit service batch. No batch open.";
+        return false;
+    }
+
+    ServiceGroup *group = m_batch;
+    m_batch = nullptr;
+    if (group->services.isEmpty()) {
+        delete group;
+        return true;
+    }
+    m_groups.append(group);
+
+    if (!m_client->isRunning()) {
+        qCDebug(dcPlatformZeroConf()) << "Avahi client not running yet. Queueing registration of" << group->services.count() << "batched services";
+        return true;
+    }
+
+    qCDebug(dcPlatformZeroConf()) << "Registering" << group->services.count() << "batched services";
+    return registerGroupInternal(group);
+}
+
+QtAvahiServicePublisher::RefreshMode QtAvahiServicePublisher::refreshMode() const
+{
+    return m_refreshMode;
+}
+
+void QtAvahiServicePublisher::setRefreshMode(RefreshMode refreshMode)
+{
+    m_refreshMode = refreshMode;
+}
+
+int QtAvahiServicePublisher::defaultRefreshInterval() const
+{
+    return m_defaultRefreshInterval;
+}
+
+void QtAvahiServicePublisher::setDefaultRefreshInterval(int refreshInterval)
+{
+    m_defaultRefreshInterval = qMax(0, refreshInterval);
+}
+
+bool QtAvahiServicePublisher::setRefreshInterval(const QString &name, int refreshInterval)
+{
+    ServiceInfo *info = m_services.value(name);
+    if (!info) {
+        qCWarning(dcPlatformZeroConf()) << "Cannot set refresh interval. Service not registered" << name;
+        return false;
+    }
+
+    info->refreshInterval = qMax(0, refreshInterval);
+    info->nextRefresh = QDateTime::currentMSecsSinceEpoch() + jitter(info->refreshInterval, 10);
+    scheduleRefresh();
+    return true;
+}
+
+bool QtAvahiServicePublisher::registerGroupInternal(ServiceGroup *group)
+{
+    // Check if the client is running
+    if (!m_client->isRunning()) {
+        qCDebug(dcPlatformZeroConf()) << "Could not register" << group->services.count() << "services yet. The client is not running.";
+        return false;
+    }
+
+    if (!group->group) {
+        group->group = avahi_entry_group_new(m_client->m_client, QtAvahiServicePublisher::callback, this);
+        if (!group->group) {
+            qCWarning(dcPlatformZeroConf()) << "Could not create entry group:" << avahi_strerror(avahi_client_errno(m_client->m_client));
+            return false;
+        }
+        m_groupsByEntryGroup.insert(group->group, group);
+    }
+
+    // Add all services of the group
+    foreach (ServiceInfo *info, group->services) {
+        AvahiIfIndex ifIndex = AVAHI_IF_UNSPEC;
+        AvahiProtocol protocol = info->hostAddress.protocol() == QAbstractSocket::IPv6Protocol ? AVAHI_PROTO_INET6 : AVAHI_PROTO_INET;
+        if (info->hostAddress != QHostAddress("0.0.0.0")) {
+            ifIndex = m_interfaceCache->interfaceIndex(info->hostAddress);
+        }
+
+        info->ifIndex = ifIndex;
+        info->protocol = protocol;
+
+        int error = avahi_entry_group_add_service_strlst(group->group,
+                                                         ifIndex,
+                                                         protocol,
+                                                         (AvahiPublishFlags) 0,
+                                                         info->effectiveNameData.constData(),
+                                                         info->serviceTypeData.constData(),
+                                                         0,
+                                                         0,
+                                                         info->port,
+                                                         info->serviceList);
+
+        if (error) {
+            if (error == AVAHI_ERR_COLLISION) {
+                QtAvahiStatistics::instance()->increment(QtAvahiStatistics::CounterCollisions);
+                // handleCollision() renames and re-adds the whole group
+                if (!handleCollision(group)) {
+                    qCWarning(dcPlatformZeroConf()) << this << "error:" << avahi_strerror(error);
+                    return false;
+                }
+                return true;
+            } else {
                 qCWarning(dcPlatformZeroConf()) << this << "error:" << avahi_strerror(error);
                 return false;
             }
-        } else {
-            qCWarning(dcPlatformZeroConf()) << this << "error:" << avahi_strerror(error);
-            return false;
         }
     }
 
-    error = avahi_entry_group_commit(info->group);
+    int error = avahi_entry_group_commit(group->group);
     if (error) {
         qCWarning(dcPlatformZeroConf()) << this << "error:" << avahi_strerror(error);
         return false;
     }
+    group->commitTime = QtAvahiStatistics::timestamp();
+    QtAvahiStatistics::instance()->increment(QtAvahiStatistics::CounterGroupCommits);
 
     return true;
 
 }
 
-void QtAvahiServicePublisher::unregisterServiceInternal(ServiceInfo *info)
+void QtAvahiServicePublisher::unregisterGroupInternal(ServiceGroup *group)
 {
-    if (info->serviceList) {
-        avahi_string_list_free(info->serviceList);
-        info->serviceList = nullptr;
+    if (group->group) {
+        avahi_entry_group_reset(group->group);
+    }
+}
+
+void QtAvahiServicePublisher::refreshServiceInternal(ServiceInfo *info)
+{
+    // Batched services are registered once the batch is committed
+    if (info->group == m_batch) {
+        return;
+    }
+
+    if (m_refreshMode == RefreshModeReregister || isGroupEmpty(info->group)) {
+        qCDebug(dcPlatformZeroConf()) << "Re-registering avahi service" << info->name;
+        reregisterGroupInternal(info->group);
+        return;
+    }
+
+    // Avahi ignores updates with the published TXT record. Publishing it with an empty string
+    // prepended and restoring it right away makes avahi announce the record again, the empty
+    // string carries no key and is skipped by browsers which see it at all.
+    qCDebug(dcPlatformZeroConf()) << "Re-announcing TXT record of avahi service" << info->name;
+    AvahiStringList *marked = avahi_string_list_add(avahi_string_list_copy(info->serviceList), "");
+    int error = updateServiceTxtInternal(info, marked);
+    avahi_string_list_free(marked);
+    if (!error) {
+        error = updateServiceTxtInternal(info, info->serviceList);
+    }
+    if (error) {
+        qCWarning(dcPlatformZeroConf()) << "Failed to refresh service" << info->name << ":" << avahi_strerror(error) << "Re-registering it.";
+        reregisterGroupInternal(info->group);
+    }
+}
+
+void QtAvahiServicePublisher::reregisterGroupInternal(ServiceGroup *group)
+{
+    unregisterGroupInternal(group);
+    registerGroupInternal(group);
+
+    // The other services of the group have been refreshed along with this one
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    foreach (ServiceInfo *info, group->services) {
+        info->nextRefresh = now + jitter(info->refreshInterval, 10);
     }
-    avahi_entry_group_reset(info->group);
 }
 
-bool QtAvahiServicePublisher::handleCollision(ServiceInfo *info)
+int QtAvahiServicePublisher::updateServiceTxtInternal(ServiceInfo *info, AvahiStringList *serviceList)
+{
+    return avahi_entry_group_update_service_txt_strlst(info->group->group,
+                                                       info->ifIndex,
+                                                       info->protocol,
+                                                       (AvahiPublishFlags) 0,
+                                                       info->effectiveNameData.constData(),
+                                                       info->serviceTypeData.constData(),
+                                                       0,
+                                                       serviceList);
+}
+
+bool QtAvahiServicePublisher::isGroupEmpty(ServiceGroup *group)
+{
+    return !group->group || avahi_entry_group_is_empty(group->group);
+}
+
+void QtAvahiServicePublisher::scheduleRefresh()
 {
-    qCDebug(dcPlatformZeroConf()) << "Handling collision for service" << info->name;
+    qint64 nextRefresh = 0;
+    foreach (ServiceInfo *info, m_services) {
+        if (info->refreshInterval > 0 && (nextRefresh == 0 || info->nextRefresh < nextRefresh)) {
+            nextRefresh = info->nextRefresh;
+        }
+    }
 
-   char* alt = avahi_alternative_service_name(info->effectiveName.toUtf8().data());
-   info->effectiveName = QLatin1String(alt);
-   free(alt);
+    if (nextRefresh == 0) {
+        m_reregisterTimer.stop();
+        return;
+    }
 
-   qCDebug(dcPlatformZeroConf()) << "Service name collision. Picking alternative service name" << info->effectiveName;
+    m_reregisterTimer.start(static_cast<int>(qBound<qint64>(0, nextRefresh - QDateTime::currentMSecsSinceEpoch(), std::numeric_limits<int>::max())));
+}
 
-   unregisterServiceInternal(info);
-   return registerServiceInternal(info);
+int QtAvahiServicePublisher::jitter(int interval, int percent)
+{
+    int range = interval * percent / 100;
+    return interval - range + QRandomGenerator::global()->bounded(2 * range + 1);
+}
+
+bool QtAvahiServicePublisher::handleCollision(ServiceGroup *group)
+{
+    // A collision affects the entry group as a whole, so all its services get an alternative name at once
+    foreach (ServiceInfo *info, group->services) {
+        qCDebug(dcPlatformZeroConf()) << "Handling collision for service" << info->name;
+
+        char* alt = avahi_alternative_service_name(info->effectiveNameData.constData());
+        setEffectiveName(info, QString::fromUtf8(alt));
+        avahi_free(alt);
+
+        qCDebug(dcPlatformZeroConf()) << "Service name collision. Picking alternative service name" << info->effectiveName;
+    }
+
+    unregisterGroupInternal(group);
+    return registerGroupInternal(group);
+}
+
+void QtAvahiServicePublisher::onClientStateChanged(AvahiClientState state)
+{
+    switch (state) {
+    case AVAHI_CLIENT_S_RUNNING:
+        // Flush registrations queued while the client wasn't running and replay
+        // all services which lost their registration on a reconnect or host name change
+        foreach (ServiceGroup *group, m_groups) {
+            if (isGroupEmpty(group)) {
+                qCDebug(dcPlatformZeroConf()) << "Registering" << group->services.count() << "queued avahi services";
+                unregisterGroupInternal(group);
+                registerGroupInternal(group);
+            }
+        }
+        break;
+    case AVAHI_CLIENT_S_COLLISION:
+    case AVAHI_CLIENT_S_REGISTERING:
+        // The host name changed, services need to be registered again once the client is running
+        foreach (ServiceGroup *group, m_groups) {
+            unregisterGroupInternal(group);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void QtAvahiServicePublisher::onInterfacesChanged()
+{
+    // Only groups with services which would end up on a different interface need to be registered again
+    foreach (ServiceGroup *group, m_groups) {
+        if (isGroupEmpty(group)) {
+            continue;
+        }
+        foreach (ServiceInfo *info, group->services) {
+            if (info->hostAddress == QHostAddress("0.0.0.0")) {
+                continue;
+            }
+            AvahiIfIndex ifIndex = m_interfaceCache->interfaceIndex(info->hostAddress);
+            if (ifIndex != info->ifIndex) {
+                qCDebug(dcPlatformZeroConf()) << "Interface of service" << info->name << "changed from" << info->ifIndex << "to" << ifIndex << ". Re-registering it.";
+                unregisterGroupInternal(group);
+                registerGroupInternal(group);
+                break;
+            }
+        }
+    }
+}
+
+void QtAvahiServicePublisher::onClientAboutToReset()
+{
+    // Entry groups die with the client, they'll be created again when it is running
+    foreach (ServiceGroup *group, m_groups) {
+        unregisterGroupInternal(group);
+        if (group->group) {
+            avahi_entry_group_free(group->group);
+            group->group = nullptr;
+        }
+    }
+    m_groupsByEntryGroup.clear();
 }
 
 void QtAvahiServicePublisher::callback(AvahiEntryGroup *group, AvahiEntryGroupState state, void *userdata)
 {
     QtAvahiServicePublisher *instance = static_cast<QtAvahiServicePublisher*>(userdata);
-    ServiceInfo *info = instance->m_servicesByGroup.value(group);
+    ServiceGroup *serviceGroup = instance->m_groupsByEntryGroup.value(group);
+    if (!serviceGroup) {
+        // Called from within avahi_entry_group_new()
+        return;
+    }
 
     switch (state) {
     case AVAHI_ENTRY_GROUP_UNCOMMITED:
@@ -204,31 +530,47 @@ void QtAvahiServicePublisher::callback(AvahiEntryGroup *group, AvahiEntryGroupSt
     case AVAHI_ENTRY_GROUP_REGISTERING:
         break;
     case AVAHI_ENTRY_GROUP_ESTABLISHED:
-        if (info->name != info->effectiveName) {
-            qCDebug(dcPlatformZeroConf()) << "Service registered:" << info->name << "as" << info->effectiveName;
-        } else {
-            qCDebug(dcPlatformZeroConf()) << "Service registered:" << info->name;
+        QtAvahiStatistics::instance()->increment(QtAvahiStatistics::CounterGroupsEstablished);
+        if (serviceGroup->commitTime > 0) {
+            QtAvahiStatistics::instance()->addSample(QtAvahiStatistics::HistogramGroupEstablishLatency, QtAvahiStatistics::timestamp() - serviceGroup->commitTime);
+            serviceGroup->commitTime = 0;
+        }
+        foreach (ServiceInfo *info, serviceGroup->services) {
+            if (info->name != info->effectiveName) {
+                qCDebug(dcPlatformZeroConf()) << "Service registered:" << info->name << "as" << info->effectiveName;
+            } else {
+                qCDebug(dcPlatformZeroConf()) << "Service registered:" << info->name;
+            }
         }
         break;
     case AVAHI_ENTRY_GROUP_COLLISION:
-        instance->handleCollision(instance->m_servicesByGroup.value(group));
+        QtAvahiStatistics::instance()->increment(QtAvahiStatistics::CounterCollisions);
+        instance->handleCollision(serviceGroup);
         break;
     case AVAHI_ENTRY_GROUP_FAILURE:
-        qCWarning(dcPlatformZeroConf()) << "Failed to register ZeroConf service" << instance->m_servicesByGroup.value(group)->name << "at avahi";
+        QtAvahiStatistics::instance()->increment(QtAvahiStatistics::CounterGroupFailures);
+        serviceGroup->commitTime = 0;
+        foreach (ServiceInfo *info, serviceGroup->services) {
+            qCWarning(dcPlatformZeroConf()) << "Failed to register ZeroConf service" << info->name << "at avahi";
+        }
         break;
     }
 }
 
+void QtAvahiServicePublisher::setEffectiveName(ServiceInfo *info, const QString &effectiveName)
+{
+    info->effectiveName = effectiveName;
+    info->effectiveNameData = effectiveName.toUtf8();
+}
+
 AvahiStringList *QtAvahiServicePublisher::createTxtList(const QHash<QString, QString> &txt)
 {
     AvahiStringList *list = nullptr;
-    if (txt.isEmpty())
-        return list;
 
-    const QStringList keys = txt.keys();
-    list = avahi_string_list_new((keys.first() + '=' + txt[keys.first()]).toLatin1().constData(), nullptr);
-    for (const QString &key : keys.mid(1)) {
-        list = avahi_string_list_add_pair(list, key.toLatin1().constData(), txt[key].toLatin1().constData());
+    // TXT values are arbitrary bytes (RFC 6763), encode them as UTF-8 so non-Latin1 values survive
+    for (QHash<QString, QString>::const_iterator it = txt.constBegin(); it != txt.constEnd(); ++it) {
+        const QByteArray value = it.value().toUtf8();
+        list = avahi_string_list_add_pair_arbitrary(list, it.key().toUtf8().constData(), reinterpret_cast<const uint8_t*>(value.constData()), value.size());
     }
 
     return list;
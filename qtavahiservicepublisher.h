@@ -36,47 +36,103 @@
 #include <QTimer>
 
 #include <avahi-client/publish.h>
+#include <avahi-client/client.h>
 
 class QtAvahiClient;
+class QtAvahiInterfaceCache;
 
 class QtAvahiServicePublisher : public QObject
 {
     Q_OBJECT
 public:
+    // RefreshModeAnnounce announces the TXT record of the service again while it stays established.
+    // RefreshModeReregister sends goodbyes, probes and announces all records of the group again.
+    enum RefreshMode {
+        RefreshModeAnnounce,
+        RefreshModeReregister
+    };
+    Q_ENUM(RefreshMode)
+
     explicit QtAvahiServicePublisher(QObject *parent = nullptr);
     explicit QtAvahiServicePublisher(QtAvahiClient *client, QObject *parent = nullptr);
     ~QtAvahiServicePublisher();
 
     bool registerService(const QString &name, const QHostAddress &hostAddress, const quint16 &port, const QString &serviceType, const QHash<QString, QString> &txtRecords);
     void unregisterService(const QString &name);
+    bool updateServiceTxt(const QString &name, const QHash<QString, QString> &txtRecords);
+
+    // Services registered between beginBatch() and commitBatch() share one entry group
+    // and are probed and announced together with a single commit.
+    void beginBatch();
+    bool commitBatch();
+
+    RefreshMode refreshMode() const;
+    void setRefreshMode(RefreshMode refreshMode);
+
+    int defaultRefreshInterval() const;
+    void setDefaultRefreshInterval(int refreshInterval);
+    bool setRefreshInterval(const QString &name, int refreshInterval);
+
+private slots:
+    void onClientStateChanged(AvahiClientState state);
+    void onClientAboutToReset();
+    void onInterfacesChanged();
 
 private:
-    class ServiceInfo {
+    class ServiceInfo;
+    class ServiceGroup {
     public:
         AvahiEntryGroup *group = nullptr;
+        QList<ServiceInfo*> services;
+        // Microseconds timestamp of the last commit until the group got established
+        qint64 commitTime = 0;
+    };
+
+    class ServiceInfo {
+    public:
+        ServiceGroup *group = nullptr;
         QString name;
         QString effectiveName;
         QHostAddress hostAddress;
         quint16 port;
         QString serviceType;
         QHash<QString, QString> txtRecords;
+        // Encoded once and only rebuilt when the name or records change
+        QByteArray effectiveNameData;
+        QByteArray serviceTypeData;
         AvahiStringList *serviceList = nullptr;
+        AvahiIfIndex ifIndex = AVAHI_IF_UNSPEC;
+        AvahiProtocol protocol = AVAHI_PROTO_UNSPEC;
+        int refreshInterval = 0;
+        qint64 nextRefresh = 0;
     };
-    bool registerServiceInternal(ServiceInfo *info);
-    void unregisterServiceInternal(ServiceInfo *info);
+    bool registerGroupInternal(ServiceGroup *group);
+    void unregisterGroupInternal(ServiceGroup *group);
+    void reregisterGroupInternal(ServiceGroup *group);
+    void refreshServiceInternal(ServiceInfo *info);
+    int updateServiceTxtInternal(ServiceInfo *info, AvahiStringList *serviceList);
+    static bool isGroupEmpty(ServiceGroup *group);
+    void scheduleRefresh();
+    static int jitter(int interval, int percent);
 
-    bool handleCollision(ServiceInfo *info);
+    bool handleCollision(ServiceGroup *group);
 
     static void callback(AvahiEntryGroup *group, AvahiEntryGroupState state, void *userdata);
 
+    static void setEffectiveName(ServiceInfo *info, const QString &effectiveName);
     static AvahiStringList *createTxtList(const QHash<QString, QString> &txt);
 
 private:
     QtAvahiClient *m_client = nullptr;
+    QtAvahiInterfaceCache *m_interfaceCache = nullptr;
     QTimer m_reregisterTimer;
+    RefreshMode m_refreshMode = RefreshModeReregister;
+    int m_defaultRefreshInterval = 60000;
 
     QHash<QString, ServiceInfo*> m_services;
-    QHash<AvahiEntryGroup*, ServiceInfo*> m_servicesByGroup;
+    QList<ServiceGroup*> m_groups;
+    QHash<AvahiEntryGroup*, ServiceGroup*> m_groupsByEntryGroup;
+    ServiceGroup *m_batch = nullptr;
 };
 
 #endif // QAVAHISERVICEPUBLISHER_H
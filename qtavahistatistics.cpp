@@ -0,0 +1,154 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* Copyright 2013 - 2020, nymea GmbH
+* Contact: contact@nymea.io
+*
+* This file is part of nymea.
+* This project including source code and documentation is protected by
+* copyright law, and remains the property of nymea GmbH. All rights, including
+* reproduction, publication, editing and translation, are reserved. The use of
+* this project is subject to the terms of a license agreement to be concluded
+* with nymea GmbH in accordance with the terms of use of nymea GmbH, available
+* under https://nymea.io/license
+*
+* GNU Lesser General Public License Usage
+* Alternatively, this project may be redistributed and/or modified under the
+* terms of the GNU Lesser General Public License as published by the Free
+* Software Foundation; version 3. This project is distributed in the hope that
+* it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+* warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this project. If not, see <https://www.gnu.org/licenses/>.
+*
+* For any further details and any questions please contact us under
+* contact@nymea.io or see our FAQ/Licensing Information on
+* https://nymea.io/license/faq
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include "qtavahistatistics.h"
+
+Q_GLOBAL_STATIC(QtAvahiStatistics, s_statistics)
+
+// Upper bounds of the histogram buckets in microseconds, the last bucket takes everything above
+const qint64 QtAvahiStatistics::s_bucketBounds[s_bucketCount - 1] = {
+    100, 500, 1000, 5000, 10000, 50000, 100000, 500000, 1000000, 5000000
+};
+
+static const char *s_counterNames[QtAvahiStatistics::CounterCount] = {
+    "watchEvents",
+    "timeouts",
+    "resolves",
+    "resolveFailures",
+    "resolveRetries",
+    "groupCommits",
+    "groupsEstablished",
+    "groupFailures",
+    "collisions",
+    "evictions"
+};
+
+static const char *s_histogramNames[QtAvahiStatistics::HistogramCount] = {
+    "resolveLatency",
+    "watchCallback",
+    "timeoutCallback",
+    "groupEstablishLatency"
+};
+
+QtAvahiStatistics::QtAvahiStatistics()
+{
+    m_clock.start();
+}
+
+QtAvahiStatistics *QtAvahiStatistics::instance()
+{
+    return s_statistics();
+}
+
+qint64 QtAvahiStatistics::timestamp()
+{
+    return s_statistics()->m_clock.nsecsElapsed() / 1000;
+}
+
+void QtAvahiStatistics::increment(Counter counter)
+{
+    QMutexLocker locker(&m_mutex);
+    m_counters[counter]++;
+}
+
+void QtAvahiStatistics::increment(Counter counter, const QString &serviceType)
+{
+    QMutexLocker locker(&m_mutex);
+    m_counters[counter]++;
+    m_typeCounters[counter][serviceType]++;
+}
+
+void QtAvahiStatistics::addSample(Histogram histogram, qint64 usecs)
+{
+    int bucket = 0;
+    while (bucket < s_bucketCount - 1 && usecs > s_bucketBounds[bucket]) {
+        bucket++;
+    }
+
+    QMutexLocker locker(&m_mutex);
+    HistogramData &data = m_histograms[histogram];
+    data.buckets[bucket]++;
+    data.count++;
+    data.sum += usecs;
+    data.max = qMax(data.max, usecs);
+}
+
+QVariantMap QtAvahiStatistics::toVariantMap() const
+{
+    QMutexLocker locker(&m_mutex);
+
+    QVariantMap counters;
+    QVariantMap typeCounters;
+    for (int i = 0; i < CounterCount; i++) {
+        counters.insert(s_counterNames[i], m_counters[i]);
+        for (QHash<QString, quint64>::const_iterator it = m_typeCounters[i].constBegin(); it != m_typeCounters[i].constEnd(); ++it) {
+            QVariantMap type = typeCounters.value(it.key()).toMap();
+            type.insert(s_counterNames[i], it.value());
+            typeCounters.insert(it.key(), type);
+        }
+    }
+
+    QVariantMap histograms;
+    for (int i = 0; i < HistogramCount; i++) {
+        const HistogramData &data = m_histograms[i];
+        QVariantList buckets;
+        for (int bucket = 0; bucket < s_bucketCount; bucket++) {
+            QVariantMap entry;
+            entry.insert("upperBoundUs", bucket < s_bucketCount - 1 ? QVariant(s_bucketBounds[bucket]) : QVariant());
+            entry.insert("count", data.buckets[bucket]);
+            buckets.append(entry);
+        }
+        QVariantMap histogram;
+        histogram.insert("count", data.count);
+        histogram.insert("sumUs", data.sum);
+        histogram.insert("maxUs", data.max);
+        histogram.insert("buckets", buckets);
+        histograms.insert(s_histogramNames[i], histogram);
+    }
+
+    QVariantMap ret;
+    ret.insert("counters", counters);
+    ret.insert("serviceTypes", typeCounters);
+    ret.insert("histograms", histograms);
+    return ret;
+}
+
+void QtAvahiStatistics::reset()
+{
+    QMutexLocker locker(&m_mutex);
+    for (int i = 0; i < CounterCount; i++) {
+        m_counters[i] = 0;
+        m_typeCounters[i].clear();
+    }
+    for (int i = 0; i < HistogramCount; i++) {
+        m_histograms[i] = HistogramData();
+    }
+}
@@ -0,0 +1,104 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* Copyright 2013 - 2020, nymea GmbH
+* Contact: contact@nymea.io
+*
+* This file is part of nymea.
+* This project including source code and documentation is protected by
+* copyright law, and remains the property of nymea GmbH. All rights, including
+* reproduction, publication, editing and translation, are reserved. The use of
+* this project is subject to the terms of a license agreement to be concluded
+* with nymea GmbH in accordance with the terms of use of nymea GmbH, available
+* under https://nymea.io/license
+*
+* GNU Lesser General Public License Usage
+* Alternatively, this project may be redistributed and/or modified under the
+* terms of the GNU Lesser General Public License as published by the Free
+* Software Foundation; version 3. This project is distributed in the hope that
+* it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+* warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this project. If not, see <https://www.gnu.org/licenses/>.
+*
+* For any further details and any questions please contact us under
+* contact@nymea.io or see our FAQ/Licensing Information on
+* https://nymea.io/license/faq
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#ifndef QTAVAHISTATISTICS_H
+#define QTAVAHISTATISTICS_H
+
+#include <QMutex>
+#include <QHash>
+#include <QVariantMap>
+#include <QElapsedTimer>
+
+// Counters and fixed bucket latency histograms of the avahi backend. Updated from the
+// backend thread, read from anywhere. There is one instance per process as the avahi
+// poll adapter has no context to carry it.
+class QtAvahiStatistics
+{
+public:
+    enum Counter {
+        CounterWatchEvents,
+        CounterTimeouts,
+        CounterResolves,
+        CounterResolveFailures,
+        CounterResolveRetries,
+        CounterGroupCommits,
+        CounterGroupsEstablished,
+        CounterGroupFailures,
+        CounterCollisions,
+        CounterEvictions,
+        CounterCount
+    };
+
+    enum Histogram {
+        // Browser NEW until the resolver found the service
+        HistogramResolveLatency,
+        // Time spent in the avahi callbacks of watches and timeouts
+        HistogramWatchCallback,
+        HistogramTimeoutCallback,
+        // Entry group commit until ESTABLISHED
+        HistogramGroupEstablishLatency,
+        HistogramCount
+    };
+
+    QtAvahiStatistics();
+
+    static QtAvahiStatistics *instance();
+    // Monotonic time in microseconds for latency samples
+    static qint64 timestamp();
+
+    void increment(Counter counter);
+    // Also counted for the service type
+    void increment(Counter counter, const QString &serviceType);
+    void addSample(Histogram histogram, qint64 usecs);
+
+    QVariantMap toVariantMap() const;
+    void reset();
+
+private:
+    static const int s_bucketCount = 11;
+    static const qint64 s_bucketBounds[s_bucketCount - 1];
+
+    struct HistogramData {
+        quint64 buckets[s_bucketCount] = {};
+        quint64 count = 0;
+        qint64 sum = 0;
+        qint64 max = 0;
+    };
+
+    QElapsedTimer m_clock;
+
+    mutable QMutex m_mutex;
+    quint64 m_counters[CounterCount] = {};
+    QHash<QString, quint64> m_typeCounters[CounterCount];
+    HistogramData m_histograms[HistogramCount];
+};
+
+#endif // QTAVAHISTATISTICS_H
@@ -31,38 +31,194 @@
 #include "zeroconfservicebrowseravahi.h"
 #include "loggingcategories.h"
 
+#include <QThread>
+#include <QMetaMethod>
+
 ZeroConfServiceBrowserAvahi::ZeroConfServiceBrowserAvahi(QtAvahiServiceBrowser *avahiBrowser, const QString &serviceType, QObject *parent) :
+    ZeroConfServiceBrowserAvahi(avahiBrowser, serviceType, QtAvahiServiceBrowser::BrowseProfileFull, parent)
+{
+}
+
+ZeroConfServiceBrowserAvahi::ZeroConfServiceBrowserAvahi(QtAvahiServiceBrowser *avahiBrowser, const QString &serviceType, QtAvahiServiceBrowser::BrowseProfile browseProfile, QObject *parent) :
+    ZeroConfServiceBrowserAvahi(avahiBrowser, serviceType, QString(), QString(), browseProfile, parent)
+{
+}
+
+ZeroConfServiceBrowserAvahi::ZeroConfServiceBrowserAvahi(QtAvahiServiceBrowser *avahiBrowser, const QString &serviceType, const QString &subtype, const QString &domain, QtAvahiServiceBrowser::BrowseProfile browseProfile, QObject *parent) :
     ZeroConfServiceBrowser(serviceType, parent),
     m_serviceType(serviceType),
     m_avahiBrowser(avahiBrowser)
 {
-    connect(m_avahiBrowser, &QtAvahiServiceBrowser::serviceAdded, this, [=](const ZeroConfServiceEntry &entry){
-        if (entry.serviceType() == m_serviceType || m_serviceType.isEmpty()) {
-            emit serviceEntryAdded(entry);
-        }
-    });
-    connect(m_avahiBrowser, &QtAvahiServiceBrowser::serviceRemoved, this, [=](const ZeroConfServiceEntry &entry){
-        if (entry.serviceType() == m_serviceType || m_serviceType.isEmpty()) {
-            emit serviceEntryRemoved(entry);
-        }
-    });
+    // Subtypes and domains narrow down a service type, browsing all types always covers everything
+    if (!m_serviceType.isEmpty()) {
+        m_subtype = subtype;
+        m_domain = domain;
+    } else if (!subtype.isEmpty() || !domain.isEmpty()) {
+        qCWarning(dcPlatformZeroConf()) << "Ignoring subtype" << subtype << "and domain" << domain << "for a browser without service type";
+    }
+
+    m_coalescingTimer.setSingleShot(true);
+    m_coalescingTimer.setInterval(250);
+    connect(&m_coalescingTimer, &QTimer::timeout, this, &ZeroConfServiceBrowserAvahi::flushEntriesChanged);
+
+    QMetaObject::invokeMethod(m_avahiBrowser.data(), [this, browseProfile](){
+        m_avahiBrowser->subscribe(m_serviceType, this, browseProfile);
+    }, backendConnectionType());
 }
 
 ZeroConfServiceBrowserAvahi::~ZeroConfServiceBrowserAvahi()
 {
+    // Blocks until the backend won't dispatch to us any more
+    if (m_avahiBrowser) {
+        QMetaObject::invokeMethod(m_avahiBrowser.data(), [this](){
+            m_avahiBrowser->unsubscribe(m_serviceType, this);
+        }, backendConnectionType());
+    }
+}
+
+QString ZeroConfServiceBrowserAvahi::subtype() const
+{
+    return m_subtype;
+}
+
+QString ZeroConfServiceBrowserAvahi::domain() const
+{
+    return m_domain;
 }
 
 QList<ZeroConfServiceEntry> ZeroConfServiceBrowserAvahi::serviceEntries() const
 {
-    if (m_serviceType.isEmpty()) {
-        return m_avahiBrowser->entries();
+    if (!m_avahiBrowser) {
+        return QList<ZeroConfServiceEntry>();
+    }
+
+    // Snapshots can be read from any thread, no need to wait for the backend
+    return m_serviceType.isEmpty() ? m_avahiBrowser->entries() : m_avahiBrowser->entries(m_serviceType, m_subtype, m_domain);
+}
+
+QList<ZeroConfServiceEntry> ZeroConfServiceBrowserAvahi::findByTxt(const QString &txtKey, const QString &txtValue) const
+{
+    if (!m_avahiBrowser) {
+        return QList<ZeroConfServiceEntry>();
+    }
+    return m_avahiBrowser->filterScope(m_avahiBrowser->findByTxt(m_serviceType, txtKey, txtValue), m_subtype, m_domain);
+}
+
+QList<ZeroConfServiceEntry> ZeroConfServiceBrowserAvahi::findByAddress(const QHostAddress &address) const
+{
+    if (!m_avahiBrowser) {
+        return QList<ZeroConfServiceEntry>();
+    }
+    return m_avahiBrowser->filterScope(m_avahiBrowser->findByAddress(address, m_serviceType), m_subtype, m_domain);
+}
+
+quint64 ZeroConfServiceBrowserAvahi::generation() const
+{
+    if (!m_avahiBrowser) {
+        return 0;
+    }
+    return m_avahiBrowser->generation(m_serviceType);
+}
+
+int ZeroConfServiceBrowserAvahi::coalescingInterval() const
+{
+    return m_coalescingTimer.interval();
+}
+
+void ZeroConfServiceBrowserAvahi::setCoalescingInterval(int coalescingInterval)
+{
+    m_coalescingTimer.setInterval(qMax(0, coalescingInterval));
+}
+
+Qt::ConnectionType ZeroConfServiceBrowserAvahi::backendConnectionType() const
+{
+    return m_avahiBrowser->thread() == QThread::currentThread() ? Qt::DirectConnection : Qt::BlockingQueuedConnection;
+}
+
+void ZeroConfServiceBrowserAvahi::handleServiceAdded(const ZeroConfServiceEntry &entry)
+{
+    // Called from the backend thread, only finished entries are handed over to our thread
+    if (thread() != QThread::currentThread()) {
+        QMetaObject::invokeMethod(this, [this, entry](){ handleServiceAdded(entry); }, Qt::QueuedConnection);
+        return;
+    }
+    emit serviceEntryAdded(entry);
+    coalesceAdded(entry);
+}
+
+void ZeroConfServiceBrowserAvahi::handleServiceRemoved(const ZeroConfServiceEntry &entry)
+{
+    if (thread() != QThread::currentThread()) {
+        QMetaObject::invokeMethod(this, [this, entry](){ handleServiceRemoved(entry); }, Qt::QueuedConnection);
+        return;
+    }
+    emit serviceEntryRemoved(entry);
+    coalesceRemoved(entry);
+}
+
+void ZeroConfServiceBrowserAvahi::handleServiceUpdated(const ZeroConfServiceEntry &oldEntry, const ZeroConfServiceEntry &newEntry)
+{
+    if (thread() != QThread::currentThread()) {
+        QMetaObject::invokeMethod(this, [this, oldEntry, newEntry](){ handleServiceUpdated(oldEntry, newEntry); }, Qt::QueuedConnection);
+        return;
+    }
+    emit serviceEntryUpdated(oldEntry, newEntry);
+    coalesceRemoved(oldEntry);
+    coalesceAdded(newEntry);
+}
+
+void ZeroConfServiceBrowserAvahi::handleInitialScanFinished(const QString &serviceType)
+{
+    if (thread() != QThread::currentThread()) {
+        QMetaObject::invokeMethod(this, [this, serviceType](){ handleInitialScanFinished(serviceType); }, Qt::QueuedConnection);
+        return;
+    }
+    // Deliver everything found during the scan before announcing it's complete
+    flushEntriesChanged();
+    emit initialScanFinished(serviceType);
+}
+
+bool ZeroConfServiceBrowserAvahi::isCoalescing() const
+{
+    static const QMetaMethod entriesChangedSignal = QMetaMethod::fromSignal(&ZeroConfServiceBrowserAvahi::serviceEntriesChanged);
+    return isSignalConnected(entriesChangedSignal);
+}
+
+void ZeroConfServiceBrowserAvahi::coalesceAdded(const ZeroConfServiceEntry &entry)
+{
+    if (!isCoalescing()) {
+        return;
+    }
+    m_addedEntries.append(entry);
+    if (!m_coalescingTimer.isActive()) {
+        m_coalescingTimer.start();
+    }
+}
+
+void ZeroConfServiceBrowserAvahi::coalesceRemoved(const ZeroConfServiceEntry &entry)
+{
+    if (!isCoalescing()) {
+        return;
+    }
+    // Entries which come and go within the same window are not reported at all
+    if (!m_addedEntries.removeOne(entry)) {
+        m_removedEntries.append(entry);
     }
-    QList<ZeroConfServiceEntry> ret;
-    foreach (const ZeroConfServiceEntry &entry, m_avahiBrowser->entries()) {
-        if (entry.serviceType() == m_serviceType) {
-            ret.append(entry);
-        }
+    if (!m_coalescingTimer.isActive()) {
+        m_coalescingTimer.start();
     }
-    return ret;
 }
 
+void ZeroConfServiceBrowserAvahi::flushEntriesChanged()
+{
+    m_coalescingTimer.stop();
+    if (m_addedEntries.isEmpty() && m_removedEntries.isEmpty()) {
+        return;
+    }
+
+    QList<ZeroConfServiceEntry> addedEntries = m_addedEntries;
+    QList<ZeroConfServiceEntry> removedEntries = m_removedEntries;
+    m_addedEntries.clear();
+    m_removedEntries.clear();
+    emit serviceEntriesChanged(addedEntries, removedEntries);
+}
@@ -32,6 +32,8 @@
 #define ZEROCONFSERVICEBROWSERAVAHI_H
 
 #include <QObject>
+#include <QPointer>
+#include <QTimer>
 
 #include "qtavahiservicebrowser.h"
 
@@ -46,14 +48,66 @@ class ZeroConfServiceBrowserAvahi : public ZeroConfServiceBrowser
 
 public:
     explicit ZeroConfServiceBrowserAvahi(QtAvahiServiceBrowser *avahiBrowser, const QString &serviceType = QString(), QObject *parent = nullptr);
+    explicit ZeroConfServiceBrowserAvahi(QtAvahiServiceBrowser *avahiBrowser, const QString &serviceType, QtAvahiServiceBrowser::BrowseProfile browseProfile, QObject *parent = nullptr);
+    // Only browses services of the type announced with the given subtype (e.g. "_printer") and/or in the given domain
+    explicit ZeroConfServiceBrowserAvahi(QtAvahiServiceBrowser *avahiBrowser, const QString &serviceType, const QString &subtype, const QString &domain, QtAvahiServiceBrowser::BrowseProfile browseProfile, QObject *parent = nullptr);
     ~ZeroConfServiceBrowserAvahi() override;
 
+    QString subtype() const;
+    QString domain() const;
+
     QList<ZeroConfServiceEntry> serviceEntries() const override;
+    // Changes whenever serviceEntries() would return something else. Invokable like findByTxt() below,
+    // callers can skip copying serviceEntries() as long as it is unchanged.
+    Q_INVOKABLE quint64 generation() const;
+
+    // Entries of the browsed type (or all types) with the given TXT record or address, without scanning all entries.
+    // A null txtValue matches TXT records without value. Not part of ZeroConfServiceBrowser, plugins reach them
+    // through the meta object:
+    //   QList<ZeroConfServiceEntry> entries;
+    //   QMetaObject::invokeMethod(browser, "findByTxt", Qt::DirectConnection, Q_RETURN_ARG(QList<ZeroConfServiceEntry>, entries),
+    //                             Q_ARG(QString, txtKey), Q_ARG(QString, txtValue));
+    // invokeMethod() returns false on backends without them, filter serviceEntries() there.
+    Q_INVOKABLE QList<ZeroConfServiceEntry> findByTxt(const QString &txtKey, const QString &txtValue) const;
+    Q_INVOKABLE QList<ZeroConfServiceEntry> findByAddress(const QHostAddress &address) const;
+
+    int coalescingInterval() const;
+    void setCoalescingInterval(int coalescingInterval);
+
+signals:
+    // Only emitted if persistent resolvers are enabled, otherwise changes are reported as removed + added
+    void serviceEntryUpdated(const ZeroConfServiceEntry &oldEntry, const ZeroConfServiceEntry &newEntry);
+
+    // Changes collected over the coalescing interval or until an initial scan finishes, only
+    // collected while connected. Removed entries are to be applied before added ones.
+    void serviceEntriesChanged(const QList<ZeroConfServiceEntry> &addedEntries, const QList<ZeroConfServiceEntry> &removedEntries);
+
+    // All services of the type present on the network at the time of browsing have been resolved
+    void initialScanFinished(const QString &serviceType);
 
 private:
+    friend class QtAvahiServiceBrowser;
+    Qt::ConnectionType backendConnectionType() const;
+
+    void handleServiceAdded(const ZeroConfServiceEntry &entry);
+    void handleServiceRemoved(const ZeroConfServiceEntry &entry);
+    void handleServiceUpdated(const ZeroConfServiceEntry &oldEntry, const ZeroConfServiceEntry &newEntry);
+    void handleInitialScanFinished(const QString &serviceType);
+
+    bool isCoalescing() const;
+    void coalesceAdded(const ZeroConfServiceEntry &entry);
+    void coalesceRemoved(const ZeroConfServiceEntry &entry);
+    void flushEntriesChanged();
+
     QString m_serviceType;
+    QString m_subtype;
+    QString m_domain;
+
+    QPointer<QtAvahiServiceBrowser> m_avahiBrowser;
 
-    QtAvahiServiceBrowser *m_avahiBrowser = nullptr;
+    QTimer m_coalescingTimer;
+    QList<ZeroConfServiceEntry> m_addedEntries;
+    QList<ZeroConfServiceEntry> m_removedEntries;
 
 };
 
@@ -32,6 +32,8 @@
 
 #include <loggingcategories.h>
 
+#include <QThread>
+
 
 ZeroConfServicePublisherAvahi::ZeroConfServicePublisherAvahi(QtAvahiServicePublisher *publisher, QObject *parent):
     ZeroConfServicePublisher(parent),
@@ -42,10 +44,55 @@ ZeroConfServicePublisherAvahi::ZeroConfServicePublisherAvahi(QtAvahiServicePubli
 
 bool ZeroConfServicePublisherAvahi::registerService(const QString &name, const QHostAddress &hostAddress, const quint16 &port, const QString &serviceType, const QHash<QString, QString> &txtRecords)
 {
-    return m_publisher->registerService(name, hostAddress, port, serviceType, txtRecords);
+    bool ret = false;
+    QMetaObject::invokeMethod(m_publisher, [&](){
+        ret = m_publisher->registerService(name, hostAddress, port, serviceType, txtRecords);
+    }, backendConnectionType());
+    return ret;
 }
 
 void ZeroConfServicePublisherAvahi::unregisterService(const QString &name)
 {
-    m_publisher->unregisterService(name);
+    QMetaObject::invokeMethod(m_publisher, [this, name](){
+        m_publisher->unregisterService(name);
+    }, backendConnectionType());
+}
+
+bool ZeroConfServicePublisherAvahi::updateServiceTxt(const QString &name, const QHash<QString, QString> &txtRecords)
+{
+    bool ret = false;
+    QMetaObject::invokeMethod(m_publisher, [&](){
+        ret = m_publisher->updateServiceTxt(name, txtRecords);
+    }, backendConnectionType());
+    return ret;
+}
+
+void ZeroConfServicePublisherAvahi::beginBatch()
+{
+    QMetaObject::invokeMethod(m_publisher, [this](){
+        m_publisher->beginBatch();
+    }, backendConnectionType());
+}
+
+bool ZeroConfServicePublisherAvahi::commitBatch()
+{
+    bool ret = false;
+    QMetaObject::invokeMethod(m_publisher, [&](){
+        ret = m_publisher->commitBatch();
+    }, backendConnectionType());
+    return ret;
+}
+
+bool ZeroConfServicePublisherAvahi::setRefreshInterval(const QString &name, int refreshInterval)
+{
+    bool ret = false;
+    QMetaObject::invokeMethod(m_publisher, [&](){
+        ret = m_publisher->setRefreshInterval(name, refreshInterval);
+    }, backendConnectionType());
+    return ret;
+}
+
+Qt::ConnectionType ZeroConfServicePublisherAvahi::backendConnectionType() const
+{
+    return m_publisher->thread() == QThread::currentThread() ? Qt::DirectConnection : Qt::BlockingQueuedConnection;
 }
@@ -45,8 +45,25 @@ public:
 
     bool registerService(const QString &name, const QHostAddress &hostAddress, const quint16 &port, const QString &serviceType, const QHash<QString, QString> &txtRecords) override;
     void unregisterService(const QString &name) override;
+    // Not part of ZeroConfServicePublisher, callers holding the base class reach it through the meta object:
+    //   bool updated = false;
+    //   QMetaObject::invokeMethod(publisher, "updateServiceTxt", Qt::DirectConnection, Q_RETURN_ARG(bool, updated),
+    //                             Q_ARG(QString, name), Q_ARG(QHash<QString, QString>, txtRecords));
+    // invokeMethod() returns false on backends without it, unregister and register the service again there.
+    Q_INVOKABLE bool updateServiceTxt(const QString &name, const QHash<QString, QString> &txtRecords);
+
+    // Services registered in between share one entry group and are probed and announced with a
+    // single commit. Invokable like updateServiceTxt(), e.g. invokeMethod(publisher, "beginBatch").
+    Q_INVOKABLE void beginBatch();
+    Q_INVOKABLE bool commitBatch();
+
+    // Refresh interval of a registered service in ms, overriding the refreshInterval setting, 0 disables
+    // refreshing it. Invokable like updateServiceTxt().
+    Q_INVOKABLE bool setRefreshInterval(const QString &name, int refreshInterval);
 
 private:
+    Qt::ConnectionType backendConnectionType() const;
+
     QtAvahiServicePublisher *m_publisher = nullptr;
 };
 